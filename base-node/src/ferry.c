@@ -1,11 +1,27 @@
+#include <zephyr/kernel.h>
 #include "ferry.h"
 #include "math.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 #define PI 3.14159265358979323846
 
-struct ferry tracked_ferries[5];
-int num_ferries = 0;
+#define FERRY_TABLE_MASK (FERRY_TABLE_SIZE - 1)
+#define FERRY_TABLE_BITS __builtin_ctz(FERRY_TABLE_SIZE)
+
+BUILD_ASSERT((FERRY_TABLE_SIZE & FERRY_TABLE_MASK) == 0, "FERRY_TABLE_SIZE must be a power of two");
+BUILD_ASSERT(FERRY_TABLE_SIZE >= 4, "FERRY_TABLE_SIZE must leave room for ferries");
+
+/*
+ * Tracked ferries, an open addressing table keyed by MMSI with linear
+ * probing. MMSI 0 is not a valid vessel and marks an empty slot. Removal
+ * shifts the rest of the probe run back instead of leaving tombstones, so
+ * lookups stay short however many ferries come and go.
+ */
+static struct ferry tracked_ferries[FERRY_TABLE_SIZE];
+static int num_ferries = 0;
+// Bumped on every lookup and insert, stamps last_seen
+static uint32_t ferry_clock = 0;
 
 static double deg2rad(double deg) {
     return deg * (PI / 180.0);
@@ -38,17 +54,92 @@ bool is_ferry_near_coords(struct ferry ferry, struct coordinates coords) {
 
 }
 
-struct ferry *get_ferry_by_mmsi(int mmsi) {
-    for (int i = 0; i < 5; i++) {
-        if (tracked_ferries[i].mmsi == mmsi) {
-            return &tracked_ferries[i];
+static size_t home_slot(int mmsi) {
+    // Fibonacci hashing, MMSIs from one fleet are close together. The top
+    // bits of the product depend on every bit of the MMSI, so take those
+    return ((uint32_t)mmsi * 2654435769u) >> (32 - FERRY_TABLE_BITS);
+}
+
+/**
+ * Find the slot holding mmsi, or the empty slot where it would go.
+ */
+static size_t find_slot(int mmsi) {
+    size_t i = home_slot(mmsi);
+    while (tracked_ferries[i].mmsi != 0 && tracked_ferries[i].mmsi != mmsi) {
+        i = (i + 1) & FERRY_TABLE_MASK;
+    }
+    return i;
+}
+
+static void remove_slot(size_t i) {
+    size_t j = i;
+
+    while (true) {
+        j = (j + 1) & FERRY_TABLE_MASK;
+        if (tracked_ferries[j].mmsi == 0) {
+            break;
+        }
+        // Move the entry back into the hole unless that would put it
+        // before its home slot
+        size_t home = home_slot(tracked_ferries[j].mmsi);
+        if (((j - home) & FERRY_TABLE_MASK) >= ((j - i) & FERRY_TABLE_MASK)) {
+            tracked_ferries[i] = tracked_ferries[j];
+            i = j;
+        }
+    }
+    tracked_ferries[i].mmsi = 0;
+    num_ferries--;
+}
+
+/**
+ * Drop the ferry seen least recently. Only needed once the table is full,
+ * so a scan is fine.
+ */
+static void evict_oldest(void) {
+    size_t oldest = 0;
+    uint32_t oldest_age = 0;
+
+    for (size_t i = 0; i < FERRY_TABLE_SIZE; i++) {
+        uint32_t age = ferry_clock - tracked_ferries[i].last_seen;
+        if (tracked_ferries[i].mmsi != 0 && age >= oldest_age) {
+            oldest = i;
+            oldest_age = age;
         }
     }
-    return NULL;
+    remove_slot(oldest);
+}
+
+/**
+ * Look up a tracked ferry and mark it as seen. The pointer is valid until
+ * the next track_new_ferry().
+ */
+struct ferry *get_ferry_by_mmsi(int mmsi) {
+    if (mmsi == 0) {
+        return NULL;
+    }
+    struct ferry *ferry = &tracked_ferries[find_slot(mmsi)];
+    if (ferry->mmsi == 0) {
+        return NULL;
+    }
+    ferry->last_seen = ++ferry_clock;
+    return ferry;
 }
 
+/**
+ * Start tracking a ferry, or replace it if it is already tracked. When the
+ * table is full the ferry seen least recently makes room.
+ */
 void track_new_ferry(struct ferry ferry) {
-    if (num_ferries == 4) return;
-    num_ferries++;
-    tracked_ferries[num_ferries] = ferry;
-}
\ No newline at end of file
+    if (ferry.mmsi == 0) return;
+
+    size_t i = find_slot(ferry.mmsi);
+    if (tracked_ferries[i].mmsi == 0) {
+        if (num_ferries == FERRY_MAX_TRACKED) {
+            evict_oldest();
+            i = find_slot(ferry.mmsi);
+        }
+        num_ferries++;
+    }
+    ferry.last_seen = ++ferry_clock;
+    tracked_ferries[i] = ferry;
+}
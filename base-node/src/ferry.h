@@ -2,6 +2,15 @@
 #define FERRY_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+// Slots in the tracking table, a power of two
+#ifndef FERRY_TABLE_SIZE
+#define FERRY_TABLE_SIZE 64
+#endif
+// Keep the table a quarter empty so probes stay short, the least recently
+// seen ferry is dropped to make room past this
+#define FERRY_MAX_TRACKED (FERRY_TABLE_SIZE * 3 / 4)
 
 struct coordinates {
     double lat;
@@ -12,10 +21,9 @@ struct ferry {
     int mmsi;
     bool near_terminal;
     struct coordinates coords;
+    uint32_t last_seen;     // Set by the table, orders ferries for eviction
 };
 
-extern struct ferry tracked_ferries[5];
-
 struct ferry *get_ferry_by_mmsi(int mmsi);
 void track_new_ferry(struct ferry ferry);
 bool is_ferry_near_coords(struct ferry ferry, struct coordinates coords);
@@ -0,0 +1,289 @@
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/printk.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ferry_feed.h"
+#include "http.h"
+#include "json.h"
+
+#define FERRY_FEED_STACK_SIZE 4096
+#define FERRY_FEED_PRIORITY 7
+#define FERRY_FEED_QUEUE_LEN 4
+#define FERRY_FEED_RETRY_MS 2000
+// The server sends an empty batch every 15 s while nothing moves
+#define FERRY_FEED_TIMEOUT_S 30
+
+#if FERRY_FEED_BINARY
+#define FERRY_FEED_EXT ".bin"
+#else
+#define FERRY_FEED_EXT ""
+#endif
+
+BUILD_ASSERT(sizeof(struct ferry_frame_header) == 8, "ferry_frame_header must match server.py");
+BUILD_ASSERT(sizeof(struct ferry_record) == 20, "ferry_record must match server.py");
+
+K_MSGQ_DEFINE(ferry_batch_msgq, sizeof(struct ferry_batch), FERRY_FEED_QUEUE_LEN, 8);
+
+K_THREAD_STACK_DEFINE(ferry_feed_stack, FERRY_FEED_STACK_SIZE);
+static struct k_thread ferry_feed_thread;
+
+static struct http_conn feed_conn = { .sock = -1 };
+
+// Last position received, the stream resumes after it on reconnect
+static uint32_t last_seq;
+static bool have_seq;
+
+/**
+ * Hand a batch to the main loop. Returns 0, or -ESTALE if the seq went
+ * back: the server restarted and counts from scratch, so the stream
+ * should be dropped and a new snapshot taken.
+ */
+static int deliver_batch(const struct ferry_batch *batch) {
+    if (have_seq && batch->seq < last_seq) {
+        printk("Ferry feed went back from %u to %u\n", last_seq, batch->seq);
+        have_seq = false;
+        return -ESTALE;
+    }
+    // The batches of a snapshot all carry the same seq, none is a gap
+    if (have_seq && batch->seq - last_seq > batch->count) {
+        printk("Ferry feed skipped %u positions\n", batch->seq - last_seq - batch->count);
+    }
+    last_seq = batch->seq;
+    have_seq = true;
+
+    // Empty batches are the server's keepalive while no ferry moves
+    if (batch->count == 0) {
+        return 0;
+    }
+    // Wait for the main loop rather than drop a position
+    k_msgq_put(&ferry_batch_msgq, batch, K_FOREVER);
+    return 0;
+}
+
+#if !FERRY_FEED_BINARY
+/* A {"seq":<n>,"ferries":[[mmsi,lat,lon],...]} line being tokenized */
+struct batch_parse {
+    struct ferry_batch batch;
+    uint8_t values;         // Of the position being read
+    bool have_seq;
+    bool bad;
+    int ret;                // Of the last batch delivered
+};
+
+static void batch_cb(struct json_parser *p, enum json_type type, const char *value) {
+    struct batch_parse *parse = p->user;
+    struct ferry_batch *batch = &parse->batch;
+
+    if (p->depth == 0) {
+        if (type == JSON_OBJECT_START) {
+            batch->count = 0;
+            parse->have_seq = false;
+            parse->bad = false;
+        } else if (type != JSON_OBJECT_END) {
+            parse->bad = true;
+        } else if (!parse->have_seq || parse->bad) {
+            printk("Bad ferry batch\n");
+        } else if (parse->ret == 0) {
+            // Nothing more after a stale batch, the stream is dropped
+            parse->ret = deliver_batch(batch);
+        }
+        return;
+    }
+
+    const char *key = json_key(p);
+    if (p->depth == 1 && type == JSON_NUMBER && key != NULL && strcmp(key, "seq") == 0) {
+        batch->seq = strtoul(value, NULL, 10);
+        parse->have_seq = true;
+        return;
+    }
+    if (p->depth < 2 || strcmp(p->key[1], "ferries") != 0) {
+        return;
+    }
+
+    if (p->depth == 2) {
+        if (type == JSON_ARRAY_START) {
+            parse->values = 0;
+            parse->bad |= batch->count == FERRY_BATCH_MAX;
+        } else if (type == JSON_ARRAY_END) {
+            parse->bad |= parse->values != 3;
+            batch->count++;
+        } else {
+            parse->bad = true;
+        }
+    } else if (p->depth == 3 && type == JSON_NUMBER && !parse->bad) {
+        struct ferry_position *pos = &batch->positions[batch->count];
+        switch (json_index(p)) {
+        case 0: pos->mmsi = strtol(value, NULL, 10); break;
+        case 1: pos->lat = strtod(value, NULL); break;
+        case 2: pos->lon = strtod(value, NULL); break;
+        }
+        parse->values++;
+    } else {
+        parse->bad = true;
+    }
+}
+
+/**
+ * Tokenize the body as it arrives, handing on each batch as its closing
+ * brace comes in. Returns when the response ends or fails; malformed JSON
+ * means the stream is lost, so it fails too.
+ */
+static void read_feed(void) {
+    struct batch_parse parse;
+    struct json_parser parser;
+    char buf[64];
+
+    parse.ret = 0;
+    json_init(&parser, batch_cb, &parse);
+    while (true) {
+        int rx = http_stream_read(&feed_conn, buf, sizeof(buf));
+        if (rx > 0 && json_feed(&parser, buf, rx) < 0) {
+            rx = -EBADMSG;
+        }
+        if (rx > 0 && parse.ret < 0) {
+            rx = parse.ret;
+        }
+        if (rx < 0) {
+            printk("Ferry feed failed: %d\n", rx);
+        }
+        if (rx <= 0) {
+            return;
+        }
+    }
+}
+
+#else
+/**
+ * Read exactly len bytes of the body. Returns len, 0 if the body ended
+ * before any of them, or a negative errno.
+ */
+static int read_exact(void *dst, size_t len) {
+    char *p = dst;
+    size_t got = 0;
+
+    while (got < len) {
+        int rx = http_stream_read(&feed_conn, p + got, len - got);
+        if (rx < 0) {
+            return rx;
+        }
+        if (rx == 0) {
+            return got == 0 ? 0 : -EBADMSG;
+        }
+        got += rx;
+    }
+    return len;
+}
+
+/**
+ * Read binary frames as they arrive. The records are used as received,
+ * only the coordinates are scaled. Returns when the response ends or
+ * fails; a bad frame means framing is lost, so it fails too.
+ */
+static void read_frames(void) {
+    struct ferry_frame_header header;
+    struct ferry_record records[FERRY_BATCH_MAX];
+    struct ferry_batch batch;
+
+    while (true) {
+        int ret = read_exact(&header, sizeof(header));
+        if (ret > 0 && (header.magic != FERRY_FRAME_MAGIC || header.count > FERRY_BATCH_MAX)) {
+            ret = -EBADMSG;
+        }
+        if (ret > 0 && header.count > 0) {
+            ret = read_exact(records, header.count * sizeof(records[0]));
+            ret = ret == 0 ? -EBADMSG : ret;
+        }
+        if (ret < 0) {
+            printk("Ferry feed failed: %d\n", ret);
+        }
+        if (ret <= 0) {
+            return;
+        }
+
+        batch.seq = header.seq;
+        batch.count = header.count;
+        for (int i = 0; i < header.count; i++) {
+            batch.positions[i] = (struct ferry_position){
+                .mmsi = records[i].mmsi,
+                .lat = records[i].lat_udeg * 1e-6,
+                .lon = records[i].lon_udeg * 1e-6,
+            };
+        }
+        ret = deliver_batch(&batch);
+        if (ret < 0) {
+            printk("Ferry feed failed: %d\n", ret);
+            return;
+        }
+    }
+}
+
+#endif
+
+static void read_body(void) {
+#if FERRY_FEED_BINARY
+    read_frames();
+#else
+    read_feed();
+#endif
+}
+
+/**
+ * Start from where every ferry is now, in one request, so the base node
+ * does not wait for each ferry to move before tracking it.
+ */
+static void fetch_snapshot(void) {
+    int status = http_stream_open(&feed_conn, "/ferry/batch" FERRY_FEED_EXT);
+    if (status == 200) {
+        read_body();
+    } else {
+        printk("Ferry snapshot failed: %d\n", status);
+    }
+    http_stream_close(&feed_conn);
+}
+
+/**
+ * Keep the ferry stream open, reconnecting after a failure from the last
+ * position received so none are missed.
+ */
+static void ferry_feed_entry(void *p1, void *p2, void *p3) {
+    char path[48];
+
+    while (true) {
+        if (!have_seq) {
+            fetch_snapshot();
+        }
+        if (have_seq) {
+            snprintf(path, sizeof(path), "/ferry/stream" FERRY_FEED_EXT "?since=%u", last_seq);
+        } else {
+            strcpy(path, "/ferry/stream" FERRY_FEED_EXT);
+        }
+
+        int status = http_stream_open(&feed_conn, path);
+        if (status == 200) {
+            // Without the timeout a half-open connection would hang the
+            // feed for good, so it is not read
+            struct timeval tv = { .tv_sec = FERRY_FEED_TIMEOUT_S, .tv_usec = 0 };
+            if (zsock_setsockopt(feed_conn.sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+                printk("Ferry feed timeout failed: %d\n", -errno);
+            } else {
+                read_body();
+            }
+        } else {
+            printk("Ferry feed open failed: %d\n", status);
+        }
+        http_stream_close(&feed_conn);
+        k_sleep(K_MSEC(FERRY_FEED_RETRY_MS));
+    }
+}
+
+void ferry_feed_start(void) {
+    k_thread_create(&ferry_feed_thread, ferry_feed_stack,
+                    K_THREAD_STACK_SIZEOF(ferry_feed_stack),
+                    ferry_feed_entry, NULL, NULL, NULL,
+                    FERRY_FEED_PRIORITY, 0, K_NO_WAIT);
+}
@@ -0,0 +1,54 @@
+#ifndef FERRY_FEED_H_
+#define FERRY_FEED_H_
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+// Most positions the server puts in one batch, FERRY_BATCH_MAX in server.py
+#define FERRY_BATCH_MAX 12
+
+// Take the feed as binary frames rather than JSON lines
+#ifndef FERRY_FEED_BINARY
+#define FERRY_FEED_BINARY 1
+#endif
+
+#define FERRY_FRAME_MAGIC 0x4246        // "FB"
+#define FERRY_RECORD_SNAPSHOT 0x0001    // Current position, not a new move
+
+/* Binary feed from the .bin endpoints, little endian like the M4, so
+ * frames are read straight into these structs. Each header is followed by
+ * count records; a frame with none is a keepalive.
+ */
+struct ferry_frame_header {
+    uint16_t magic;
+    uint16_t count;
+    uint32_t seq;           // Of the last record in the frame
+};
+
+struct ferry_record {
+    uint32_t mmsi;
+    int32_t lat_udeg;       // Microdegrees
+    int32_t lon_udeg;
+    uint32_t timestamp;     // Unix time at the server
+    uint16_t flags;
+    uint16_t reserved;
+};
+
+struct ferry_position {
+    int32_t mmsi;
+    double lat;
+    double lon;
+};
+
+/* One line of the server's /ferry/stream feed, or of a /ferry/batch response */
+struct ferry_batch {
+    uint32_t seq;           // Of the last position in the batch
+    uint8_t count;
+    struct ferry_position positions[FERRY_BATCH_MAX];
+};
+
+extern struct k_msgq ferry_batch_msgq;
+
+void ferry_feed_start(void);
+
+#endif
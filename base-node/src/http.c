@@ -0,0 +1,458 @@
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http.h"
+#include "socket.h"
+
+#include "auth.h"
+
+/*
+ * One HTTP/1.1 connection to the server, kept open between requests. A
+ * batch of requests is written back to back and the responses read in
+ * order, so the 100 ms poll costs one round trip instead of a TCP
+ * handshake per request.
+ */
+static struct http_conn shared = { .sock = -1 };
+
+static void conn_close(struct http_conn *conn) {
+    if (conn->sock >= 0) {
+        zsock_close(conn->sock);
+        conn->sock = -1;
+    }
+    conn->rx_len = 0;
+}
+
+static int rx_fill(struct http_conn *conn) {
+    if (conn->rx_len == sizeof(conn->rx_buf)) {
+        return -ENOBUFS;
+    }
+    int rx = zsock_recv(conn->sock, conn->rx_buf + conn->rx_len,
+                        sizeof(conn->rx_buf) - conn->rx_len, 0);
+    if (rx == 0) {
+        return -ECONNRESET;
+    }
+    if (rx < 0) {
+        return -errno;
+    }
+    conn->rx_len += rx;
+    conn->rx_total += rx;
+    return rx;
+}
+
+static void rx_consume(struct http_conn *conn, size_t len) {
+    memmove(conn->rx_buf, conn->rx_buf + len, conn->rx_len - len);
+    conn->rx_len -= len;
+}
+
+/**
+ * Wait for a full CRLF terminated line at the start of rx_buf and NUL
+ * terminate it in place. Returns the bytes to consume for it.
+ */
+static int read_line(struct http_conn *conn) {
+    while (true) {
+        char *end = memchr(conn->rx_buf, '\n', conn->rx_len);
+        if (end != NULL) {
+            size_t len = end - conn->rx_buf;
+            if (len > 0 && conn->rx_buf[len - 1] == '\r') {
+                len--;
+            }
+            conn->rx_buf[len] = '\0';
+            return end - conn->rx_buf + 1;
+        }
+        int ret = rx_fill(conn);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+}
+
+/**
+ * Parse the status line and the headers that frame the body. Returns the
+ * HTTP status.
+ */
+static int read_headers(struct http_conn *conn) {
+    int status;
+    long content_length = -1;
+
+    conn->chunked = false;
+    conn->close = false;
+    conn->chunk_started = false;
+    conn->body_done = false;
+
+    int line = read_line(conn);
+    if (line < 0) {
+        return line;
+    }
+    if (sscanf(conn->rx_buf, "HTTP/1.%*d %d", &status) != 1) {
+        printk("Bad HTTP status line: %s\n", conn->rx_buf);
+        return -EBADMSG;
+    }
+    rx_consume(conn, line);
+
+    while (true) {
+        line = read_line(conn);
+        if (line < 0) {
+            return line;
+        }
+        if (conn->rx_buf[0] == '\0') {
+            rx_consume(conn, line);
+            break;
+        }
+
+        char *value = strchr(conn->rx_buf, ':');
+        if (value != NULL) {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+            if (strcasecmp(conn->rx_buf, "Content-Length") == 0) {
+                content_length = strtol(value, NULL, 10);
+            } else if (strcasecmp(conn->rx_buf, "Transfer-Encoding") == 0) {
+                conn->chunked = strcasecmp(value, "chunked") == 0;
+            } else if (strcasecmp(conn->rx_buf, "Connection") == 0) {
+                conn->close = strcasecmp(value, "close") == 0;
+            }
+        }
+        rx_consume(conn, line);
+    }
+
+    conn->until_close = !conn->chunked && content_length < 0;
+    conn->left = conn->chunked ? 0 : MAX(content_length, 0);
+    return status;
+}
+
+/**
+ * Move to the next chunk once the current one is used up, skipping the
+ * CRLF after its data. A zero size chunk and its trailers end the body.
+ */
+static int next_chunk(struct http_conn *conn) {
+    int line;
+
+    if (conn->chunk_started) {
+        line = read_line(conn);
+        if (line < 0) {
+            return line;
+        }
+        rx_consume(conn, line);
+    }
+
+    line = read_line(conn);
+    if (line < 0) {
+        return line;
+    }
+    conn->left = strtoul(conn->rx_buf, NULL, 16);
+    conn->chunk_started = true;
+    rx_consume(conn, line);
+    if (conn->left > 0) {
+        return 0;
+    }
+
+    while (true) {
+        line = read_line(conn);
+        if (line < 0) {
+            return line;
+        }
+        bool blank = conn->rx_buf[0] == '\0';
+        rx_consume(conn, line);
+        if (blank) {
+            conn->body_done = true;
+            return 0;
+        }
+    }
+}
+
+/**
+ * Read up to size body bytes as they arrive. Returns 0 at the end of the
+ * body.
+ */
+static int body_read(struct http_conn *conn, char *buf, size_t size) {
+    if (conn->chunked && conn->left == 0 && !conn->body_done) {
+        int ret = next_chunk(conn);
+        if (ret < 0) {
+            return ret;
+        }
+    } else if (!conn->chunked && !conn->until_close && conn->left == 0) {
+        conn->body_done = true;
+    }
+    if (conn->body_done) {
+        return 0;
+    }
+
+    if (conn->rx_len == 0) {
+        int ret = rx_fill(conn);
+        if (ret == -ECONNRESET && conn->until_close) {
+            conn->body_done = true;
+            return 0;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    size_t take = MIN(size, conn->rx_len);
+    if (!conn->until_close) {
+        take = MIN(take, conn->left);
+        conn->left -= take;
+    }
+    memcpy(buf, conn->rx_buf, take);
+    rx_consume(conn, take);
+    return take;
+}
+
+/**
+ * Read one response off the connection. Leaves the socket closed if the
+ * server asked for it, or if the body ran until the connection closed.
+ */
+static int read_response(struct http_conn *conn, struct http_request *req) {
+    char discard[64];
+    int ret;
+
+    req->body_len = 0;
+    req->status = read_headers(conn);
+    if (req->status < 0) {
+        return req->status;
+    }
+
+    while (true) {
+        char *dst = discard;
+        size_t room = sizeof(discard);
+        if (req->buf != NULL && req->body_len < req->buf_size - 1) {
+            dst = req->buf + req->body_len;
+            room = req->buf_size - 1 - req->body_len;
+        }
+        ret = body_read(conn, dst, room);
+        if (ret <= 0) {
+            break;
+        }
+        if (req->json != NULL) {
+            // A malformed body is still read to the end to keep the
+            // connection in step, the parser remembers the error
+            json_feed(req->json, dst, ret);
+        }
+        req->body_len += ret;
+    }
+
+    if (req->buf != NULL) {
+        req->buf[MIN(req->body_len, req->buf_size - 1)] = '\0';
+    }
+    if (ret == 0 && (conn->close || conn->until_close)) {
+        conn_close(conn);
+    }
+    return ret;
+}
+
+static int send_all(struct http_conn *conn, const char *data, size_t len) {
+    while (len > 0) {
+        int ret = zsock_send(conn->sock, data, len, 0);
+        if (ret < 0) {
+            return -errno;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static int send_request(struct http_conn *conn, const struct http_request *req) {
+    char msg[HTTP_TX_BUF_SIZE];
+    int len;
+
+    if (req->body != NULL) {
+        len = snprintf(msg, sizeof(msg),
+            "%s %s HTTP/1.1\r\n"
+            "Host: " SERVER_IP "\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: %u\r\n"
+            "\r\n"
+            "%s",
+            req->method, req->path, (unsigned)strlen(req->body), req->body);
+    } else {
+        len = snprintf(msg, sizeof(msg),
+            "%s %s HTTP/1.1\r\n"
+            "Host: " SERVER_IP "\r\n"
+            "\r\n",
+            req->method, req->path);
+    }
+
+    if (len < 0 || len >= sizeof(msg)) {
+        printk("Can't format request for %s\n", req->path);
+        return -ENOMEM;
+    }
+    return send_all(conn, msg, len);
+}
+
+static int exchange_once(struct http_conn *conn, struct http_request *reqs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int ret = send_request(conn, &reqs[i]);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (conn->sock < 0) {
+            // Server closed after an earlier response in the batch
+            return -ECONNRESET;
+        }
+        int ret = read_response(conn, &reqs[i]);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Whether the batch may be sent twice. The server may have acted on a
+ * request and closed before answering it, so only GETs are resent; a POST
+ * to /arriving sent again would announce the ferry twice.
+ */
+static bool can_resend(const struct http_request *reqs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(reqs[i].method, "GET") != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Whether a kept-alive connection has been closed by the server, or has
+ * something unasked for waiting on it, while it sat idle.
+ */
+static bool conn_stale(struct http_conn *conn) {
+    char c;
+    int ret = zsock_recv(conn->sock, &c, 1, ZSOCK_MSG_PEEK | ZSOCK_MSG_DONTWAIT);
+    return !(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+/**
+ * Send count requests pipelined on the shared connection and read their
+ * responses, opening the connection first if needed. A kept-alive
+ * connection the server has since dropped is reopened and a batch of GETs
+ * sent again, as long as nothing of it was answered yet.
+ */
+int http_exchange(struct http_request *reqs, size_t count) {
+    int attempts = can_resend(reqs, count) ? 2 : 1;
+
+    // A batch that cannot be resent checks first for the usual way a
+    // kept-alive connection is lost, the server closing it while idle
+    if (attempts == 1 && shared.sock >= 0 && conn_stale(&shared)) {
+        conn_close(&shared);
+    }
+
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        bool reused = shared.sock >= 0;
+
+        if (!reused) {
+            shared.sock = connect_to_ip();
+            if (shared.sock < 0) {
+                return -ENOTCONN;
+            }
+        }
+
+        shared.rx_total = 0;
+        int ret = exchange_once(&shared, reqs, count);
+        if (ret == 0) {
+            return 0;
+        }
+        conn_close(&shared);
+
+        if (!reused || shared.rx_total > 0 || attempt + 1 == attempts) {
+            printk("HTTP exchange failed: %d\n", ret);
+            return ret;
+        }
+    }
+    return -ECONNRESET;
+}
+
+/**
+ * GET path into buf. Returns the HTTP status or a negative errno.
+ */
+int http_get(const char *path, char *buf, size_t buf_size) {
+    struct http_request req = {
+        .method = "GET",
+        .path = path,
+        .buf = buf,
+        .buf_size = buf_size,
+    };
+
+    int ret = http_exchange(&req, 1);
+    return ret < 0 ? ret : req.status;
+}
+
+/**
+ * GET path and pick the given fields out of the JSON body in one pass as
+ * it is read. Returns the HTTP status or a negative errno; check the
+ * fields for which were found.
+ */
+int http_get_json(const char *path, struct json_fields *fields) {
+    struct json_parser parser;
+    struct http_request req = {
+        .method = "GET",
+        .path = path,
+        .json = &parser,
+    };
+
+    json_fields_init(&parser, fields);
+    int ret = http_exchange(&req, 1);
+    return ret < 0 ? ret : req.status;
+}
+
+/**
+ * POST a JSON body to path, discarding the response body. Returns the
+ * HTTP status or a negative errno.
+ */
+int http_post(const char *path, const char *body) {
+    struct http_request req = {
+        .method = "POST",
+        .path = path,
+        .body = body,
+    };
+
+    int ret = http_exchange(&req, 1);
+    return ret < 0 ? ret : req.status;
+}
+
+/**
+ * GET a streamed response on a connection of its own, leaving the body to
+ * be read with http_stream_read() as the server sends it. Returns the HTTP
+ * status or a negative errno.
+ */
+int http_stream_open(struct http_conn *conn, const char *path) {
+    const struct http_request req = {
+        .method = "GET",
+        .path = path,
+    };
+
+    conn->rx_len = 0;
+    conn->sock = connect_to_ip();
+    if (conn->sock < 0) {
+        return -ENOTCONN;
+    }
+
+    int ret = send_request(conn, &req);
+    if (ret == 0) {
+        ret = read_headers(conn);
+    }
+    if (ret < 0) {
+        conn_close(conn);
+    }
+    return ret;
+}
+
+/**
+ * Block until some of the streamed body arrives. Returns the bytes read,
+ * 0 once the server ends the response, or a negative errno.
+ */
+int http_stream_read(struct http_conn *conn, char *buf, size_t size) {
+    return body_read(conn, buf, size);
+}
+
+void http_stream_close(struct http_conn *conn) {
+    conn_close(conn);
+}
@@ -0,0 +1,47 @@
+#ifndef HTTP_H_
+#define HTTP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "json.h"
+
+// Responses are parsed out of this buffer, so it bounds the longest header line
+#define HTTP_RX_BUF_SIZE 1024
+#define HTTP_TX_BUF_SIZE 512
+
+struct http_request {
+    const char *method;
+    const char *path;
+    const char *body;       // JSON, or NULL for no body
+    char *buf;              // Response body, NUL terminated, or NULL to discard
+    struct json_parser *json;   // Tokenizes the body as it arrives instead of buf
+    size_t buf_size;
+    int status;             // Set from the response
+    size_t body_len;        // Set from the response, longer than buf if truncated
+};
+
+/* A connection to the server and the state of the response being read */
+struct http_conn {
+    int sock;
+    char rx_buf[HTTP_RX_BUF_SIZE];
+    size_t rx_len;          // Received but not yet parsed
+    size_t rx_total;
+    bool chunked;
+    bool until_close;       // Body ends when the server closes
+    bool close;             // Server sent Connection: close
+    bool chunk_started;
+    bool body_done;
+    size_t left;            // Of the body, or of the current chunk
+};
+
+int http_exchange(struct http_request *reqs, size_t count);
+int http_get(const char *path, char *buf, size_t buf_size);
+int http_get_json(const char *path, struct json_fields *fields);
+int http_post(const char *path, const char *body);
+
+int http_stream_open(struct http_conn *conn, const char *path);
+int http_stream_read(struct http_conn *conn, char *buf, size_t size);
+void http_stream_close(struct http_conn *conn);
+
+#endif
@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+/*
+ * Push tokenizer for the small JSON documents the server sends. Bytes are
+ * fed in as they come off the socket, in whatever pieces recv() returns,
+ * and each value is reported once when its last byte arrives. Nothing is
+ * buffered beyond the current key and scalar, so a response is parsed in
+ * one pass without holding the body.
+ */
+
+enum json_state {
+    S_VALUE,            // Expecting a value
+    S_FIRST_VALUE,      // Just after '[', a value or ']'
+    S_KEY_OR_END,       // In an object, a key or '}'
+    S_KEY,
+    S_COLON,
+    S_STRING,
+    S_LITERAL,          // Number, true, false or null
+    S_AFTER_VALUE,      // ',' or the end of the container
+};
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool in_array(const struct json_parser *p) {
+    return p->arrays & (1u << p->depth);
+}
+
+static void emit(struct json_parser *p, enum json_type type, const char *value) {
+    if (p->cb != NULL) {
+        p->cb(p, type, value);
+    }
+}
+
+static void value_done(struct json_parser *p) {
+    p->state = p->depth == 0 ? S_VALUE : S_AFTER_VALUE;
+}
+
+static bool open_container(struct json_parser *p, bool array) {
+    if (p->depth == JSON_MAX_DEPTH) {
+        return false;
+    }
+    emit(p, array ? JSON_ARRAY_START : JSON_OBJECT_START, NULL);
+    p->depth++;
+    p->arrays = array ? p->arrays | (1u << p->depth) : p->arrays & ~(1u << p->depth);
+    p->index[p->depth] = 0;
+    p->key[p->depth][0] = '\0';
+    p->state = array ? S_FIRST_VALUE : S_KEY_OR_END;
+    return true;
+}
+
+static bool close_container(struct json_parser *p, bool array) {
+    if (p->depth == 0 || in_array(p) != array) {
+        return false;
+    }
+    p->depth--;
+    emit(p, array ? JSON_ARRAY_END : JSON_OBJECT_END, NULL);
+    value_done(p);
+    return true;
+}
+
+static bool end_literal(struct json_parser *p) {
+    p->token[p->token_len] = '\0';
+    if (strcmp(p->token, "true") == 0) {
+        emit(p, JSON_TRUE, p->token);
+    } else if (strcmp(p->token, "false") == 0) {
+        emit(p, JSON_FALSE, p->token);
+    } else if (strcmp(p->token, "null") == 0) {
+        emit(p, JSON_NULL, p->token);
+    } else if (p->token[0] == '-' || (p->token[0] >= '0' && p->token[0] <= '9')) {
+        emit(p, JSON_NUMBER, p->token);
+    } else {
+        return false;
+    }
+    value_done(p);
+    return true;
+}
+
+/**
+ * Add a character of a key or string, resolving escapes. Returns true at
+ * the closing quote.
+ */
+static bool string_char(struct json_parser *p, char c, char *dst, size_t size) {
+    if (p->unicode_left > 0) {
+        p->unicode_left--;
+        return false;
+    }
+    if (p->escape) {
+        p->escape = false;
+        switch (c) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'u':
+            // Not needed for anything we read, keep a placeholder
+            p->unicode_left = 4;
+            c = '?';
+            break;
+        }
+    } else if (c == '\\') {
+        p->escape = true;
+        return false;
+    } else if (c == '"') {
+        dst[p->token_len] = '\0';
+        return true;
+    }
+
+    if (p->token_len < size - 1) {
+        dst[p->token_len++] = c;
+    }
+    return false;
+}
+
+static bool feed_char(struct json_parser *p, char c) {
+    switch (p->state) {
+    case S_LITERAL:
+        if (c != ',' && c != '}' && c != ']' && !is_space(c)) {
+            if (p->token_len == sizeof(p->token) - 1) {
+                return false;
+            }
+            p->token[p->token_len++] = c;
+            return true;
+        }
+        if (!end_literal(p)) {
+            return false;
+        }
+        // The delimiter belongs to the container
+        return feed_char(p, c);
+
+    case S_STRING:
+        if (string_char(p, c, p->token, sizeof(p->token))) {
+            emit(p, JSON_STRING, p->token);
+            value_done(p);
+        }
+        return true;
+
+    case S_KEY:
+        if (string_char(p, c, p->key[p->depth], sizeof(p->key[p->depth]))) {
+            p->state = S_COLON;
+        }
+        return true;
+
+    default:
+        break;
+    }
+
+    if (is_space(c)) {
+        return true;
+    }
+
+    switch (p->state) {
+    case S_FIRST_VALUE:
+        if (c == ']') {
+            return close_container(p, true);
+        }
+        // fallthrough
+    case S_VALUE:
+        if (c == '{' || c == '[') {
+            return open_container(p, c == '[');
+        }
+        p->token_len = 0;
+        if (c == '"') {
+            p->state = S_STRING;
+            return true;
+        }
+        p->token[p->token_len++] = c;
+        p->state = S_LITERAL;
+        return true;
+
+    case S_KEY_OR_END:
+        if (c == '}') {
+            return close_container(p, false);
+        }
+        if (c != '"') {
+            return false;
+        }
+        p->token_len = 0;
+        p->state = S_KEY;
+        return true;
+
+    case S_COLON:
+        p->state = S_VALUE;
+        return c == ':';
+
+    case S_AFTER_VALUE:
+        if (c == '}' || c == ']') {
+            return close_container(p, c == ']');
+        }
+        if (c != ',') {
+            return false;
+        }
+        if (in_array(p)) {
+            p->index[p->depth]++;
+            p->state = S_VALUE;
+        } else {
+            p->state = S_KEY_OR_END;
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void json_init(struct json_parser *p, json_cb_t cb, void *user) {
+    memset(p, 0, sizeof(*p));
+    p->cb = cb;
+    p->user = user;
+    p->state = S_VALUE;
+}
+
+/**
+ * Tokenize the next len bytes of the document. Several documents may
+ * follow each other, as in a stream of lines. Returns -EINVAL once the
+ * input is malformed; the parser must then be reinitialised.
+ */
+int json_feed(struct json_parser *p, const char *data, size_t len) {
+    for (size_t i = 0; i < len && !p->error; i++) {
+        p->error = !feed_char(p, data[i]);
+    }
+    return p->error ? -EINVAL : 0;
+}
+
+/**
+ * Key of the value being reported, or NULL if it is in an array or at the
+ * top level.
+ */
+const char *json_key(const struct json_parser *p) {
+    if (p->depth == 0 || in_array(p)) {
+        return NULL;
+    }
+    return p->key[p->depth];
+}
+
+/**
+ * Index of the value being reported in its array, or -1 if it is not in
+ * one.
+ */
+int json_index(const struct json_parser *p) {
+    if (p->depth == 0 || !in_array(p)) {
+        return -1;
+    }
+    return p->index[p->depth];
+}
+
+static void fields_cb(struct json_parser *p, enum json_type type, const char *value) {
+    struct json_fields *fields = p->user;
+
+    if (p->depth != 1 || type != JSON_NUMBER) {
+        return;
+    }
+    const char *key = json_key(p);
+    if (key == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < fields->count; i++) {
+        struct json_field *field = &fields->fields[i];
+        if (strcmp(field->key, key) != 0) {
+            continue;
+        }
+        if (field->type == JSON_FIELD_INT) {
+            *(int *)field->dest = strtol(value, NULL, 10);
+        } else {
+            *(double *)field->dest = strtod(value, NULL);
+        }
+        field->found = true;
+    }
+}
+
+/**
+ * Set the parser up to store the numbers under the given keys of the top
+ * level object as they are tokenized, in whatever order they come.
+ */
+void json_fields_init(struct json_parser *p, struct json_fields *fields) {
+    for (size_t i = 0; i < fields->count; i++) {
+        fields->fields[i].found = false;
+    }
+    json_init(p, fields_cb, fields);
+}
+
+bool json_fields_all_found(const struct json_fields *fields) {
+    for (size_t i = 0; i < fields->count; i++) {
+        if (!fields->fields[i].found) {
+            return false;
+        }
+    }
+    return true;
+}
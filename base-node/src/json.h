@@ -0,0 +1,74 @@
+#ifndef JSON_H_
+#define JSON_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_MAX_DEPTH 8
+#define JSON_KEY_MAX 16
+// Longer strings are truncated, numbers fit easily
+#define JSON_TOKEN_MAX 32
+
+enum json_type {
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+};
+
+struct json_parser;
+
+/* Called for each value as it completes. value is the NUL terminated token
+ * for scalars, NULL for containers. json_key() and json_index() say where
+ * the value sits in its parent.
+ */
+typedef void (*json_cb_t)(struct json_parser *p, enum json_type type, const char *value);
+
+struct json_parser {
+    json_cb_t cb;
+    void *user;
+    uint8_t state;
+    uint8_t depth;
+    bool error;
+    bool escape;
+    uint8_t unicode_left;   // Hex digits of a \u escape still to skip
+    uint32_t arrays;        // Bit per depth, set if that container is an array
+    uint16_t index[JSON_MAX_DEPTH + 1];
+    char key[JSON_MAX_DEPTH + 1][JSON_KEY_MAX];
+    char token[JSON_TOKEN_MAX];
+    uint8_t token_len;
+};
+
+void json_init(struct json_parser *p, json_cb_t cb, void *user);
+int json_feed(struct json_parser *p, const char *data, size_t len);
+const char *json_key(const struct json_parser *p);
+int json_index(const struct json_parser *p);
+
+/* Pull scalars out of the top level object by key */
+enum json_field_type {
+    JSON_FIELD_INT,
+    JSON_FIELD_DOUBLE,
+};
+
+struct json_field {
+    const char *key;
+    uint8_t type;           // enum json_field_type
+    void *dest;             // int or double
+    bool found;
+};
+
+struct json_fields {
+    struct json_field *fields;
+    size_t count;
+};
+
+void json_fields_init(struct json_parser *p, struct json_fields *fields);
+bool json_fields_all_found(const struct json_fields *fields);
+
+#endif
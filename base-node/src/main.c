@@ -11,11 +11,12 @@
 #include <string.h>
 #include <stdio.h>
 #include "wifi.h"
-#include "socket.h"
+#include "http.h"
 #include "zephyr/drivers/usb/usb_dc.h"
 #include "zephyr/sys/util.h"
 #include <stdbool.h>
 #include "ferry.h"
+#include "ferry_feed.h"
 #include <zephyr/fs/fs.h>
 #include <zephyr/device.h>
 #include <zephyr/storage/flash_map.h>
@@ -42,10 +43,10 @@ static struct fs_mount_t fat_storage_mnt = {
 };
 
 
-void process_received_packet(char* packet_buf);
+void process_ferry_batch(struct ferry_batch *batch);
+void process_ferry_position(struct ferry_position *position);
 void handle_volume_change(void);
 void send_volume(int volume);
-void receive_ferry_packet(char* packet_buf, size_t packet_buf_size);
 void send_arriving(int mmsi);
 void send_departing(int mmsi);
 void ferry_arriving_action(int mmsi);
@@ -60,27 +61,6 @@ int current_volume = 100;
 
 struct coordinates UQ_FERRY_TERMINAL = {-27.496776268829635, 153.0195395998301};
 
-/* HTTP get for ferry data */
-static const char GET_REQ_FERRY[] =
-    "GET /ferry HTTP/1.1\r\n"
-    "Host: " SERVER_IP "\r\n"
-    "Connection: close\r\n"
-    "\r\n";
-
-/* HTTP get for volume change data */
-static const char GET_VOL_CHANGE[] =
-    "GET /volumechange HTTP/1.1\r\n"
-    "Host: " SERVER_IP "\r\n"
-    "Connection: close\r\n"
-    "\r\n";
-
-/* HTTP get for RTC syncing */
-static const char GET_RTC[] =
-    "GET /rtc HTTP/1.1\r\n"
-    "Host: " SERVER_IP "\r\n"
-    "Connection: close\r\n"
-    "\r\n";
-
 int main(void) {
 
     mount_fs();
@@ -91,13 +71,18 @@ int main(void) {
 
     sync_rtc_with_server();
 
+    ferry_feed_start();
+
     while(1) {
-        char packet_buf[512];
-        receive_ferry_packet(packet_buf, sizeof(packet_buf));
+        struct ferry_batch batch;
 
-        process_received_packet(packet_buf);
+        // Ferry positions are pushed by the feed thread, handle each batch
+        // as it arrives and poll for volume changes in between
+        if (k_msgq_get(&ferry_batch_msgq, &batch, K_MSEC(100)) == 0) {
+            process_ferry_batch(&batch);
+            continue;
+        }
 
-        k_sleep(K_MSEC(100));
         handle_volume_change();
     }
 
@@ -114,67 +99,21 @@ int main(void) {
 }
 
 
-void receive_ferry_packet(char* packet_buf, size_t packet_buf_size) {
-    int sock = connect_to_ip();
-    int ret = zsock_send(sock, GET_REQ_FERRY, strlen(GET_REQ_FERRY), 0);
-    if (ret < 0) {
-        printk("HTTP send failed: %d\n", ret);
-        return;
-    }
-    
-    while (true) {
-        int rx = zsock_recv(sock, packet_buf, packet_buf_size - 1, 0);
-        if (rx > 0) {
-            packet_buf[rx] = '\0';
-            printk("%s", packet_buf);
-        } else if (rx == 0) {
-            /* peer closed cleanly */
-            break;
-        } else {
-            printk("HTTP recv error: %d\n", rx);
-            break;
-        }
-    }
-    int closeret = zsock_close(sock);
-    if (closeret < 0) {
-        printk("Socket close error rx ferry: %d\n", closeret);
-    }
-    printk("\n");
-}
-
-
 void handle_volume_change(void) {
-    char packet_buf[128];
-    int sock = connect_to_ip();
-    int ret = zsock_send(sock, GET_VOL_CHANGE, strlen(GET_VOL_CHANGE), 0);
-    if (ret < 0) {
-        printk("HTTP send failed: %d\n", ret);
+    int status, change;
+    struct json_field field_list[] = {
+        { "status", JSON_FIELD_INT, &status },
+        { "change", JSON_FIELD_INT, &change },
+    };
+    struct json_fields fields = { field_list, ARRAY_SIZE(field_list) };
+
+    if (http_get_json("/volumechange", &fields) < 0) {
         return;
     }
-    
-    while (true) {
-        int rx = zsock_recv(sock, packet_buf, sizeof(packet_buf) - 1, 0);
-        if (rx > 0) {
-            packet_buf[rx] = '\0';
-            printk("%s", packet_buf);
-        } else if (rx == 0) {
-            /* peer closed cleanly */
-            break;
-        } else {
-            printk("HTTP recv error: %d\n", rx);
-            break;
-        }
-    }
-    int closeret = zsock_close(sock);
-    if (closeret < 0) {
-        printk("Socket close error handle volume change: %d\n", closeret);
-    }
-    printk("\n");
 
     // process packet
-    int status, change;
-    if (sscanf(packet_buf, "{\"status\":%d,\"change\":%d", &status, &change) == 2) {
-        printk("parsed: status=%d, change=%dn", status, change);
+    if (json_fields_all_found(&fields)) {
+        printk("parsed: status=%d, change=%d\n", status, change);
 
         if (change == -1 || status == 404) return;   // no change required
 
@@ -194,36 +133,23 @@ void handle_volume_change(void) {
 }
 
 void sync_rtc_with_server(void) {
-    char packet_buf[128];
-    int sock = connect_to_ip();
-    int ret = zsock_send(sock, GET_RTC, strlen(GET_RTC), 0);
-    if (ret < 0) {
-        printk("HTTP send failed: %d\n", ret);
+    int year, mon, day, hour, min, sec;
+    struct json_field field_list[] = {
+        { "year", JSON_FIELD_INT, &year },
+        { "mon", JSON_FIELD_INT, &mon },
+        { "day", JSON_FIELD_INT, &day },
+        { "hour", JSON_FIELD_INT, &hour },
+        { "min", JSON_FIELD_INT, &min },
+        { "sec", JSON_FIELD_INT, &sec },
+    };
+    struct json_fields fields = { field_list, ARRAY_SIZE(field_list) };
+
+    if (http_get_json("/rtc", &fields) < 0) {
         return;
     }
-    
-    while (true) {
-        int rx = zsock_recv(sock, packet_buf, sizeof(packet_buf) - 1, 0);
-        if (rx > 0) {
-            packet_buf[rx] = '\0';
-            printk("%s", packet_buf);
-        } else if (rx == 0) {
-            /* peer closed cleanly */
-            break;
-        } else {
-            printk("HTTP recv error: %d\n", rx);
-            break;
-        }
-    }
-    int closeret = zsock_close(sock);
-    if (closeret < 0) {
-        printk("Socket close error handle volume change: %d\n", closeret);
-    }
-    printk("\n");
 
     // process packet
-    int year, mon, day, hour, min, sec;
-    if (sscanf(packet_buf, "{\"year\":%d,\"mon\":%d,\"day\":%d,\"hour\":%d,\"min\":%d,\"sec\":%d", &year, &mon, &day, &hour, &min, &sec) == 6) {
+    if (json_fields_all_found(&fields)) {
         printk("parsed time: %d %d %d %d %d %d\n", year, mon, day, hour, min, sec);;
 
         struct rtc_time set_time = {
@@ -242,81 +168,56 @@ void sync_rtc_with_server(void) {
 }
 
 
-void process_received_packet(char* packet_buf) {
-    double lat, lon;
-    int status;
-    int32_t mmsi;
-    if (sscanf(packet_buf,
-           "{\"status\":%d,\"mmsi\":%d,\"lat\":%lf,\"lon\":%lf",
-           &status, &mmsi, &lat, &lon) == 4) {
-        printk("parsed: status=%d, mmsi=%d, lat=%f, lon=%f\n", status, mmsi, lat, lon);
-
-        if (status == 404) return;
-        
-        struct coordinates ferryCoords = {lat, lon};
-        // attempt to get ferry
-        struct ferry *existing_ferry = get_ferry_by_mmsi(mmsi);
-        if (existing_ferry == NULL) {
-            // add new ferry
-            double dist = distance_between_coords(ferryCoords, UQ_FERRY_TERMINAL);
-            bool near = dist < 100;
-            struct ferry new_ferry = {mmsi, near, ferryCoords};
-            track_new_ferry(new_ferry);
-            if (near) {
-                // new ferry is near terminal
-                ferry_arriving_action(mmsi);
-            }
-        } else{
-            // update existing ferry coords
-            existing_ferry->coords.lat = lat;
-            existing_ferry->coords.lon = lon;
-
-            bool near = is_ferry_near_coords(*existing_ferry, UQ_FERRY_TERMINAL);
-            if (near && !existing_ferry->near_terminal) {
-                // This means that an existing ferry has now moved close to a terminal and it wasn't before
-                ferry_arriving_action(mmsi);
-            } else if (!near && existing_ferry->near_terminal) {
-                // existing ferry has moved away from a terminal
-                ferry_departing_action(mmsi);
-            }
-            existing_ferry->near_terminal = near;
-        }
-    } else {
-        printk("JSON parse failed\n");
+void process_ferry_batch(struct ferry_batch *batch) {
+    printk("ferry batch %u: %u positions\n", batch->seq, batch->count);
+    for (int i = 0; i < batch->count; i++) {
+        process_ferry_position(&batch->positions[i]);
     }
 }
 
 
-void send_post(char* endpoint, char* body) {
-    char msg[256];
-
-    int len = snprintf(msg, sizeof(msg), 
-        "POST /%s HTTP/1.1\r\n"
-        "Host: " SERVER_IP "\r\n"
-        "Content-Type: application/json\r\n"
-        "Content-Length: %u\r\n"
-        "Connection: close\r\n"
-        "\r\n"
-        "%s",
-        endpoint,
-        (unsigned)strlen(body),
-        body);
-
-    if (len < 0 || len >= sizeof(msg)) {
-        printk("Can't format packet\n");
-        return;
+void process_ferry_position(struct ferry_position *position) {
+    int32_t mmsi = position->mmsi;
+    double lat = position->lat;
+    double lon = position->lon;
+
+    printk("mmsi=%d, lat=%f, lon=%f\n", mmsi, lat, lon);
+
+    struct coordinates ferryCoords = {lat, lon};
+    // attempt to get ferry
+    struct ferry *existing_ferry = get_ferry_by_mmsi(mmsi);
+    if (existing_ferry == NULL) {
+        // add new ferry
+        double dist = distance_between_coords(ferryCoords, UQ_FERRY_TERMINAL);
+        bool near = dist < 100;
+        struct ferry new_ferry = {mmsi, near, ferryCoords};
+        track_new_ferry(new_ferry);
+        if (near) {
+            // new ferry is near terminal
+            ferry_arriving_action(mmsi);
+        }
+    } else{
+        // update existing ferry coords
+        existing_ferry->coords.lat = lat;
+        existing_ferry->coords.lon = lon;
+
+        bool near = is_ferry_near_coords(*existing_ferry, UQ_FERRY_TERMINAL);
+        if (near && !existing_ferry->near_terminal) {
+            // This means that an existing ferry has now moved close to a terminal and it wasn't before
+            ferry_arriving_action(mmsi);
+        } else if (!near && existing_ferry->near_terminal) {
+            // existing ferry has moved away from a terminal
+            ferry_departing_action(mmsi);
+        }
+        existing_ferry->near_terminal = near;
     }
+}
 
-    int sock = connect_to_ip();
-    int ret = zsock_send(sock, msg, len, 0);
 
-    if (ret < 0) {
-        printk("HTTP POST send failed: %d\n", ret);
-        return;
-    }
-    int closeret = zsock_close(sock);
-    if (closeret < 0) {
-        printk("Socket close error send post: %d\n", closeret);
+void send_post(char* endpoint, char* body) {
+    int status = http_post(endpoint, body);
+    if (status < 0 || status >= 300) {
+        printk("HTTP POST %s failed: %d\n", endpoint, status);
     }
 }
 
@@ -324,7 +225,7 @@ void send_volume(int volume) {
     char body[64];
     snprintf(body, sizeof(body), "{\"volume\":\"%d\"}", volume);
 
-    send_post("volume", body);
+    send_post("/volume", body);
 }
 
 
@@ -332,7 +233,7 @@ void send_arriving(int mmsi) {
     char body[64];
     snprintf(body, sizeof(body), "{\"mmsi\":\"%d\"}", mmsi);
 
-    send_post("arriving", body);
+    send_post("/arriving", body);
 }
 
 
@@ -340,7 +241,7 @@ void send_departing(int mmsi) {
     char body[64];
     snprintf(body, sizeof(body), "{\"mmsi\":\"%d\"}", mmsi);
 
-    send_post("departing", body);
+    send_post("/departing", body);
 }
 
 
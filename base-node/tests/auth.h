@@ -0,0 +1,8 @@
+#ifndef HOST_AUTH_H_
+#define HOST_AUTH_H_
+
+/* Stands in for the board's auth.h, which is not in the tree */
+#define SERVER_IP "192.0.2.1"
+#define SERVER_PORT 8000
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Included rather than linked to report how long the probe runs get */
+#include "ferry.c"
+
+#define LOOKUPS 2000000
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Look a random ferry from the pool up, tracking it if it is not, the
+ * way a batch of positions is handled.
+ */
+static void run(const char *name, const int *pool, int pool_size) {
+    int hits = 0;
+    int probes = 0;
+    int longest = 0;
+
+    memset(tracked_ferries, 0, sizeof(tracked_ferries));
+    num_ferries = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < LOOKUPS; i++) {
+        int mmsi = pool[next_random() % pool_size];
+        if (get_ferry_by_mmsi(mmsi) != NULL) {
+            hits++;
+        } else {
+            track_new_ferry((struct ferry){ .mmsi = mmsi });
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < FERRY_TABLE_SIZE; i++) {
+        if (tracked_ferries[i].mmsi != 0) {
+            int probe = (i - home_slot(tracked_ferries[i].mmsi)) & FERRY_TABLE_MASK;
+            probes += probe;
+            longest = probe > longest ? probe : longest;
+        }
+    }
+    printf("%-24s %4d MMSIs  %6.1f ns/lookup  %5.1f%% hits  probe %.2f avg %d max\n",
+           name, pool_size, elapsed / LOOKUPS, 100.0 * hits / LOOKUPS,
+           num_ferries ? (double)probes / num_ferries : 0.0, longest);
+}
+
+int main(void) {
+    static int pool[800];
+
+    printf("%d slots, %d tracked at most\n", FERRY_TABLE_SIZE, FERRY_MAX_TRACKED);
+
+    // One fleet's MMSIs are consecutive
+    for (int i = 0; i < FERRY_MAX_TRACKED; i++) {
+        pool[i] = 503000000 + i;
+    }
+    run("fleet, all tracked", pool, FERRY_MAX_TRACKED);
+
+    for (int i = 0; i < 800; i++) {
+        pool[i] = 200000000 + next_random() % 600000000;
+    }
+    run("random, all tracked", pool, FERRY_MAX_TRACKED);
+    run("random, evicting", pool, 200);
+    run("random, evicting", pool, 800);
+
+    for (int i = 0; i < 800; i++) {
+        pool[i] = 503000000 + i;
+    }
+    run("fleet, evicting", pool, 800);
+    return 0;
+}
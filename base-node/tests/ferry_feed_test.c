@@ -0,0 +1,217 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Included rather than linked to drive the decoder the build selects,
+ * JSON lines or binary frames, with bodies cut at every byte.
+ */
+#include "ferry_feed.c"
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* The body being served, and the one place it is cut */
+static const char *body;
+static size_t body_len;
+static size_t body_pos;
+static size_t body_split;
+static size_t piece_max;
+
+int http_stream_open(struct http_conn *conn, const char *path) {
+    return 200;
+}
+
+int http_stream_read(struct http_conn *conn, char *buf, size_t size) {
+    size_t end = body_pos < body_split ? body_split : body_len;
+    size_t len = end - body_pos;
+
+    len = len < size ? len : size;
+    len = len < piece_max ? len : piece_max;
+    memcpy(buf, body + body_pos, len);
+    body_pos += len;
+    return len;
+}
+
+void http_stream_close(struct http_conn *conn) {
+}
+
+int zsock_setsockopt(int sock, int level, int optname, const void *optval, socklen_t optlen) {
+    return 0;
+}
+
+/* Batches the main loop would have got */
+static struct ferry_batch received[8];
+static int num_received;
+
+int k_msgq_put(struct k_msgq *q, const void *data, k_timeout_t timeout) {
+    if (num_received < 8) {
+        memcpy(&received[num_received], data, sizeof(received[0]));
+    }
+    num_received++;
+    return 0;
+}
+
+/* A snapshot split over two batches that share the seq, a keepalive, then
+ * two moves, as server.py's ferry_batches() and ferry_stream() send them
+ */
+static const struct ferry_batch expected[] = {
+    { .seq = 41, .count = 2, .positions = {
+        { 503123456, -27.468123, 153.028456 },
+        { 503654321, -27.4701, 153.0312 },
+    } },
+    { .seq = 41, .count = 1, .positions = {
+        { 503000007, -27.399, 153.1 },
+    } },
+    { .seq = 43, .count = 2, .positions = {
+        { 503123456, -27.46799, 153.0285 },
+        { 503777000, -27.5, 153.100001 },
+    } },
+};
+#define NUM_EXPECTED (int)(sizeof(expected) / sizeof(expected[0]))
+
+#if !FERRY_FEED_BINARY
+static const char sample[] =
+    "{\"seq\":41,\"ferries\":[[503123456,-27.468123,153.028456],[503654321,-27.4701,153.0312]]}\n"
+    "{\"seq\":41,\"ferries\":[[503000007,-27.399,153.1]]}\n"
+    "{\"seq\":41,\"ferries\":[]}\n"
+    "{\"seq\":43,\"ferries\":[[503123456,-27.46799,153.0285],[503777000,-27.5,153.100001]]}\n";
+
+// Batches 43 then 2, the server restarted in between
+static const char restarted[] =
+    "{\"seq\":43,\"ferries\":[[503123456,-27.46799,153.0285]]}\n"
+    "{\"seq\":2,\"ferries\":[[503000007,-27.399,153.1]]}\n"
+    "{\"seq\":3,\"ferries\":[[503777000,-27.5,153.100001]]}\n";
+
+static size_t sample_body(char *out) {
+    memcpy(out, sample, sizeof(sample) - 1);
+    return sizeof(sample) - 1;
+}
+
+static size_t restarted_body(char *out) {
+    memcpy(out, restarted, sizeof(restarted) - 1);
+    return sizeof(restarted) - 1;
+}
+
+#else
+/* Pack a frame the way server.py's encode_ferry_frame() does */
+static size_t put_frame(char *out, uint32_t seq, const struct ferry_position *positions,
+                        int count) {
+    struct ferry_frame_header header = { FERRY_FRAME_MAGIC, count, seq };
+    size_t len = sizeof(header);
+
+    memcpy(out, &header, sizeof(header));
+    for (int i = 0; i < count; i++) {
+        struct ferry_record record = {
+            .mmsi = positions[i].mmsi,
+            .lat_udeg = lround(positions[i].lat * 1e6),
+            .lon_udeg = lround(positions[i].lon * 1e6),
+            .timestamp = 1760000000,
+            .flags = seq == 41 ? FERRY_RECORD_SNAPSHOT : 0,
+        };
+        memcpy(out + len, &record, sizeof(record));
+        len += sizeof(record);
+    }
+    return len;
+}
+
+static size_t sample_body(char *out) {
+    size_t len = 0;
+
+    len += put_frame(out + len, 41, expected[0].positions, expected[0].count);
+    len += put_frame(out + len, 41, expected[1].positions, expected[1].count);
+    len += put_frame(out + len, 41, NULL, 0);
+    len += put_frame(out + len, 43, expected[2].positions, expected[2].count);
+    return len;
+}
+
+static size_t restarted_body(char *out) {
+    size_t len = 0;
+
+    len += put_frame(out + len, 43, expected[2].positions, 1);
+    len += put_frame(out + len, 2, expected[1].positions, 1);
+    len += put_frame(out + len, 3, &expected[2].positions[1], 1);
+    return len;
+}
+#endif
+
+static void serve(const char *data, size_t len, size_t split, size_t max) {
+    body = data;
+    body_len = len;
+    body_pos = 0;
+    body_split = split;
+    piece_max = max;
+    num_received = 0;
+    last_seq = 0;
+    have_seq = false;
+    read_body();
+}
+
+static bool same_position(const struct ferry_position *a, const struct ferry_position *b) {
+    // Microdegrees in the binary feed, 6 decimal places in the JSON one
+    return a->mmsi == b->mmsi && fabs(a->lat - b->lat) < 1e-7 && fabs(a->lon - b->lon) < 1e-7;
+}
+
+static void check_received(void) {
+    CHECK(num_received == NUM_EXPECTED);
+    for (int i = 0; i < num_received && i < NUM_EXPECTED; i++) {
+        CHECK(received[i].seq == expected[i].seq);
+        CHECK(received[i].count == expected[i].count);
+        for (int j = 0; j < received[i].count && j < expected[i].count; j++) {
+            CHECK(same_position(&received[i].positions[j], &expected[i].positions[j]));
+        }
+    }
+    CHECK(have_seq && last_seq == 43);
+    CHECK(body_pos == body_len);
+}
+
+static void check_every_split(void) {
+    static char data[512];
+    size_t len = sample_body(data);
+
+    for (size_t split = 0; split <= len && failures == 0; split++) {
+        serve(data, len, split, SIZE_MAX);
+        check_received();
+    }
+    serve(data, len, 0, 1);
+    check_received();
+}
+
+static void check_truncated(void) {
+    static char data[512];
+    size_t len = sample_body(data);
+
+    // Cut inside the last batch, which must not be handed on
+    serve(data, len - 3, 0, SIZE_MAX);
+    CHECK(num_received == NUM_EXPECTED - 1);
+    CHECK(last_seq == 41);
+}
+
+static void check_restart(void) {
+    static char data[512];
+    size_t len = restarted_body(data);
+
+    for (size_t split = 0; split <= len && failures == 0; split++) {
+        serve(data, len, split, SIZE_MAX);
+        // Nothing after the seq went back, and the next connect resnapshots
+        CHECK(num_received == 1);
+        CHECK(received[0].seq == 43);
+        CHECK(!have_seq);
+    }
+}
+
+int main(void) {
+    check_every_split();
+    check_truncated();
+    check_restart();
+    if (failures == 0) {
+        printf("ferry feed %s ok\n", FERRY_FEED_BINARY ? "frames" : "JSON");
+    }
+    return failures != 0;
+}
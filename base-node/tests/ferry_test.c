@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Included rather than linked to check the table itself: probe runs must
+ * stay unbroken through every insert, removal and eviction.
+ */
+#include "ferry.c"
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void) {
+    // xorshift32, the same sequence on every host
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void reset_table(void) {
+    memset(tracked_ferries, 0, sizeof(tracked_ferries));
+    num_ferries = 0;
+    ferry_clock = 0;
+}
+
+static struct ferry ferry_at(int mmsi, double lat) {
+    return (struct ferry){ .mmsi = mmsi, .coords = { .lat = lat, .lon = 153.0 } };
+}
+
+/**
+ * Every ferry is in the probe run from its home slot, with no gaps before
+ * it, and is there once.
+ */
+static void check_table(void) {
+    int count = 0;
+
+    for (size_t i = 0; i < FERRY_TABLE_SIZE; i++) {
+        int mmsi = tracked_ferries[i].mmsi;
+        if (mmsi == 0) {
+            continue;
+        }
+        count++;
+        CHECK(find_slot(mmsi) == i);
+        for (size_t j = home_slot(mmsi); j != i; j = (j + 1) & FERRY_TABLE_MASK) {
+            CHECK(tracked_ferries[j].mmsi != 0);
+        }
+    }
+    CHECK(count == num_ferries);
+    CHECK(num_ferries <= FERRY_MAX_TRACKED);
+}
+
+static int mmsi_with_home(size_t slot, int from) {
+    while (home_slot(from) != slot) {
+        from++;
+    }
+    return from;
+}
+
+static void check_insert_lookup(void) {
+    reset_table();
+
+    for (int i = 0; i < 10; i++) {
+        track_new_ferry(ferry_at(503000000 + i, i));
+    }
+    for (int i = 0; i < 10; i++) {
+        struct ferry *ferry = get_ferry_by_mmsi(503000000 + i);
+        CHECK(ferry != NULL && ferry->mmsi == 503000000 + i && ferry->coords.lat == i);
+    }
+    CHECK(get_ferry_by_mmsi(503000010) == NULL);
+
+    // MMSI 0 marks an empty slot, never a ferry
+    CHECK(get_ferry_by_mmsi(0) == NULL);
+    track_new_ferry(ferry_at(0, 1.0));
+    CHECK(num_ferries == 10);
+
+    // Tracking a ferry again replaces it
+    track_new_ferry(ferry_at(503000003, 99.0));
+    struct ferry *ferry = get_ferry_by_mmsi(503000003);
+    CHECK(ferry != NULL && ferry->coords.lat == 99.0);
+    CHECK(num_ferries == 10);
+    check_table();
+}
+
+static void check_backward_shift(void) {
+    // A run homed two slots from the end wraps round to the start, and
+    // pushes a ferry homed at slot 0 along behind it
+    const size_t home = FERRY_TABLE_SIZE - 2;
+    int run[5];
+    int from = 200000000;
+
+    reset_table();
+    for (int i = 0; i < 5; i++) {
+        run[i] = mmsi_with_home(home, from);
+        from = run[i] + 1;
+        track_new_ferry(ferry_at(run[i], i));
+    }
+    int displaced = mmsi_with_home(0, 300000000);
+    track_new_ferry(ferry_at(displaced, 5));
+    CHECK(find_slot(displaced) == 3);
+    check_table();
+
+    remove_slot(find_slot(run[1]));
+    CHECK(get_ferry_by_mmsi(run[1]) == NULL);
+    for (int i = 0; i < 5; i++) {
+        struct ferry *ferry = get_ferry_by_mmsi(run[i]);
+        CHECK((ferry != NULL) == (i != 1));
+        CHECK(ferry == NULL || ferry->coords.lat == i);
+    }
+    // Everything after the hole moved back one, the run is a slot shorter
+    CHECK(find_slot(displaced) == 2);
+    CHECK(tracked_ferries[3].mmsi == 0);
+    CHECK(num_ferries == 5);
+    check_table();
+
+    // Removing the head of the run moves the rest to their home slots
+    remove_slot(find_slot(run[0]));
+    CHECK(find_slot(run[2]) == home);
+    CHECK(find_slot(displaced) == 1);
+    check_table();
+}
+
+static void check_eviction(void) {
+    reset_table();
+
+    for (int i = 0; i < FERRY_MAX_TRACKED; i++) {
+        track_new_ferry(ferry_at(503100000 + i, i));
+    }
+    CHECK(num_ferries == FERRY_MAX_TRACKED);
+
+    // Seen least recently, though not the first tracked
+    for (int i = 0; i < FERRY_MAX_TRACKED; i++) {
+        if (i != 5) {
+            CHECK(get_ferry_by_mmsi(503100000 + i) != NULL);
+        }
+    }
+    track_new_ferry(ferry_at(503199999, 0));
+    CHECK(num_ferries == FERRY_MAX_TRACKED);
+    CHECK(get_ferry_by_mmsi(503100005) == NULL);
+    CHECK(get_ferry_by_mmsi(503199999) != NULL);
+    for (int i = 0; i < FERRY_MAX_TRACKED; i++) {
+        if (i != 5) {
+            CHECK(get_ferry_by_mmsi(503100000 + i) != NULL);
+        }
+    }
+    check_table();
+}
+
+/* The same lookups and inserts against a plain least recently seen list */
+static int reference[FERRY_MAX_TRACKED];
+static uint32_t reference_seen[FERRY_MAX_TRACKED];
+static int reference_count;
+
+static int reference_find(int mmsi) {
+    for (int i = 0; i < reference_count; i++) {
+        if (reference[i] == mmsi) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void check_against_reference(void) {
+    int pool[300];
+    uint32_t clock = 0;
+
+    reset_table();
+    reference_count = 0;
+    // Start near the wrap so ages are computed across it
+    ferry_clock = UINT32_MAX - 1000;
+
+    for (size_t i = 0; i < sizeof(pool) / sizeof(pool[0]); i++) {
+        pool[i] = 200000000 + next_random() % 600000000;
+    }
+
+    for (int op = 0; op < 200000; op++) {
+        int mmsi = pool[next_random() % (sizeof(pool) / sizeof(pool[0]))];
+        struct ferry *ferry = get_ferry_by_mmsi(mmsi);
+        int ref = reference_find(mmsi);
+
+        clock++;
+        CHECK((ferry != NULL) == (ref >= 0));
+        if (ref >= 0) {
+            reference_seen[ref] = clock;
+            continue;
+        }
+
+        track_new_ferry(ferry_at(mmsi, op));
+        clock++;
+        if (reference_count == FERRY_MAX_TRACKED) {
+            int oldest = 0;
+            for (int i = 1; i < reference_count; i++) {
+                if (reference_seen[i] < reference_seen[oldest]) {
+                    oldest = i;
+                }
+            }
+            reference_count--;
+            reference[oldest] = reference[reference_count];
+            reference_seen[oldest] = reference_seen[reference_count];
+        }
+        reference[reference_count] = mmsi;
+        reference_seen[reference_count] = clock;
+        reference_count++;
+
+        if (op % 1000 == 0) {
+            check_table();
+        }
+        if (failures > 0) {
+            return;
+        }
+    }
+    CHECK(num_ferries == reference_count);
+    check_table();
+}
+
+int main(void) {
+    check_insert_lookup();
+    check_backward_shift();
+    check_eviction();
+    check_against_reference();
+    if (failures == 0) {
+        printf("ferry table ok\n");
+    }
+    return failures != 0;
+}
@@ -0,0 +1,282 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Included rather than linked to reach the shared connection, against a
+ * canned server that cuts what it sends wherever it is told to.
+ */
+#include "http.c"
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define FAKE_SOCK 3
+
+static struct {
+    const char *replies[2];     // Sent on each connection in turn, NULL for none
+    int conn;                   // Of the open connection, -1 before the first
+    size_t pos;
+    size_t split;               // Where the reply is cut into two recv()s
+    bool idle_closed;           // Closed the open connection while it sat idle
+    int connects;
+} server;
+
+static char sent[2048];
+static size_t sent_len;
+
+int connect_to_ip(void) {
+    server.conn++;
+    server.connects++;
+    server.pos = 0;
+    server.idle_closed = false;
+    return FAKE_SOCK;
+}
+
+int zsock_close(int sock) {
+    return 0;
+}
+
+ssize_t zsock_send(int sock, const void *buf, size_t len, int flags) {
+    CHECK(sent_len + len < sizeof(sent));
+    if (sent_len + len < sizeof(sent)) {
+        memcpy(sent + sent_len, buf, len);
+        sent_len += len;
+        sent[sent_len] = '\0';
+    }
+    return len;
+}
+
+ssize_t zsock_recv(int sock, void *buf, size_t len, int flags) {
+    const char *reply = server.replies[server.conn];
+    size_t reply_len = reply != NULL ? strlen(reply) : 0;
+
+    if (flags & ZSOCK_MSG_PEEK) {
+        if (server.idle_closed) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (reply == NULL) {
+        return 0;
+    }
+    size_t end = server.pos < server.split ? server.split : reply_len;
+    size_t take = MIN(len, end - server.pos);
+    memcpy(buf, reply + server.pos, take);
+    server.pos += take;
+    // Past the end of the reply the server has closed
+    return take;
+}
+
+/**
+ * Serve first on a connection that is already open, or on a new one, and
+ * then, if it is needed, on a second new one.
+ */
+static void serve(bool kept_alive, const char *first, const char *second, size_t split) {
+    server.replies[0] = first;
+    server.replies[1] = second;
+    server.pos = 0;
+    server.split = split;
+    server.idle_closed = false;
+    server.connects = 0;
+    sent_len = 0;
+    sent[0] = '\0';
+
+    shared.rx_len = 0;
+    if (kept_alive) {
+        server.conn = 0;
+        shared.sock = FAKE_SOCK;
+    } else {
+        server.conn = -1;
+        shared.sock = -1;
+    }
+}
+
+static int count_of(const char *haystack, const char *needle) {
+    int count = 0;
+
+    for (const char *p = strstr(haystack, needle); p != NULL; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+/* A Content-Length response, then a chunked one with an extension and a
+ * trailer, read back to back on the kept-alive connection
+ */
+static const char pipelined[] =
+    "HTTP/1.1 200 OK\r\n"
+    "content-length: 26\r\n"
+    "\r\n"
+    "{\"status\":404,\"change\":-1}"
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "7;ext=1\r\n"
+    "{\"rtc\":\r\n"
+    "12\r\n"
+    "1760000000,\"ms\":5}\r\n"
+    "0\r\n"
+    "X-Trailer: a\r\n"
+    "\r\n";
+
+static void check_pipelined(void) {
+    for (size_t split = 0; split <= sizeof(pipelined) - 1 && failures == 0; split++) {
+        char volume[64];
+        char rtc[64];
+        int status = 0;
+        int change = 0;
+        struct json_field field_list[] = {
+            { "status", JSON_FIELD_INT, &status },
+            { "change", JSON_FIELD_INT, &change },
+        };
+        struct json_fields fields = { field_list, ARRAY_SIZE(field_list) };
+        struct json_parser parser;
+        struct http_request reqs[] = {
+            { .method = "GET", .path = "/volumechange", .buf = volume,
+              .buf_size = sizeof(volume), .json = &parser },
+            { .method = "GET", .path = "/rtc", .buf = rtc, .buf_size = sizeof(rtc) },
+        };
+
+        json_fields_init(&parser, &fields);
+        serve(true, pipelined, NULL, split);
+        CHECK(http_exchange(reqs, 2) == 0);
+
+        CHECK(reqs[0].status == 200);
+        CHECK(reqs[0].body_len == 26);
+        CHECK(strcmp(volume, "{\"status\":404,\"change\":-1}") == 0);
+        CHECK(json_fields_all_found(&fields) && status == 404 && change == -1);
+
+        CHECK(reqs[1].status == 200);
+        CHECK(reqs[1].body_len == 25);
+        CHECK(strcmp(rtc, "{\"rtc\":1760000000,\"ms\":5}") == 0);
+
+        // Both requests went out before any reply, and nothing is left over
+        CHECK(count_of(sent, "GET ") == 2);
+        CHECK(strstr(sent, "GET /volumechange HTTP/1.1\r\nHost: " SERVER_IP "\r\n\r\n") == sent);
+        CHECK(server.connects == 0);
+        CHECK(shared.sock == FAKE_SOCK);
+        CHECK(shared.rx_len == 0);
+        CHECK(server.pos == sizeof(pipelined) - 1);
+    }
+}
+
+static void check_truncated_body(void) {
+    char buf[16];
+
+    // A body longer than the buffer is read to the end and cut short
+    serve(true, "HTTP/1.1 200 OK\r\nContent-Length: 20\r\n\r\n01234567890123456789", NULL, 0);
+    CHECK(http_get("/", buf, sizeof(buf)) == 200);
+    CHECK(strcmp(buf, "012345678901234") == 0);
+    CHECK(shared.sock == FAKE_SOCK);
+    CHECK(shared.rx_len == 0);
+}
+
+static void check_close(void) {
+    static const char *replies[] = {
+        "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok",
+        // Neither length nor chunks, the body runs until the server closes
+        "HTTP/1.0 200 OK\r\n\r\nok",
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(replies); i++) {
+        for (size_t split = 0; split <= strlen(replies[i]) && failures == 0; split++) {
+            char buf[16];
+
+            serve(false, replies[i], NULL, split);
+            CHECK(http_get("/", buf, sizeof(buf)) == 200);
+            CHECK(strcmp(buf, "ok") == 0);
+            CHECK(server.connects == 1);
+            CHECK(shared.sock < 0);
+        }
+    }
+}
+
+static const char streamed[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "18\r\n"
+    "{\"seq\":41,\"ferries\":[]}\n\r\n"
+    "1\r\n"
+    "{\r\n"
+    "17\r\n"
+    "\"seq\":42,\"ferries\":[]}\n\r\n"
+    "0\r\n"
+    "\r\n";
+
+static void check_stream(void) {
+    struct http_conn conn = { .sock = -1 };
+
+    for (size_t split = 0; split <= sizeof(streamed) - 1 && failures == 0; split++) {
+        char body[128];
+        size_t len = 0;
+        int rx;
+
+        serve(false, streamed, NULL, split);
+        CHECK(http_stream_open(&conn, "/ferry/stream") == 200);
+        // Small reads, so chunks and reads do not line up either
+        while ((rx = http_stream_read(&conn, body + len, 5)) > 0) {
+            len += rx;
+        }
+        CHECK(rx == 0);
+        body[len] = '\0';
+        CHECK(strcmp(body, "{\"seq\":41,\"ferries\":[]}\n{\"seq\":42,\"ferries\":[]}\n") == 0);
+        CHECK(http_stream_read(&conn, body, 5) == 0);
+        http_stream_close(&conn);
+    }
+
+    // The server going away mid chunk is an error, not the end
+    serve(false, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n18\r\n{\"seq\"",
+          NULL, 0);
+    CHECK(http_stream_open(&conn, "/ferry/stream") == 200);
+    char buf[64];
+    CHECK(http_stream_read(&conn, buf, sizeof(buf)) == 6);
+    CHECK(http_stream_read(&conn, buf, sizeof(buf)) == -ECONNRESET);
+    http_stream_close(&conn);
+}
+
+static const char ok[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+
+static void check_resend(void) {
+    // A GET on a connection the server dropped goes again on a new one
+    serve(true, NULL, ok, 0);
+    CHECK(http_get("/volumechange", NULL, 0) == 200);
+    CHECK(server.connects == 1);
+    CHECK(count_of(sent, "GET /volumechange") == 2);
+
+    // A POST the server may have acted on is not sent twice
+    serve(true, NULL, ok, 0);
+    CHECK(http_post("/arriving", "{\"mmsi\":503123456}") == -ECONNRESET);
+    CHECK(server.connects == 0);
+    CHECK(count_of(sent, "POST /arriving") == 1);
+
+    // but one is sent on a new connection if the old one is seen to be
+    // closed before it goes out
+    serve(true, NULL, ok, 0);
+    server.idle_closed = true;
+    CHECK(http_post("/arriving", "{\"mmsi\":503123456}") == 200);
+    CHECK(server.connects == 1);
+    CHECK(count_of(sent, "POST /arriving") == 1);
+    CHECK(strstr(sent, "Content-Length: 18\r\n\r\n{\"mmsi\":503123456}") != NULL);
+}
+
+int main(void) {
+    check_pipelined();
+    check_truncated_body();
+    check_close();
+    check_stream();
+    check_resend();
+    if (failures == 0) {
+        printf("http ok\n");
+    }
+    return failures != 0;
+}
@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* Two documents back to back, as lines of a stream */
+static const char doc[] =
+    "{\"status\":404,\"change\":-1,\"rtc\":{\"ms\":5},\"name\":\"a\\\"b\\u00e9\\n\","
+    "\"list\":[1,2.5e3,true,false,null,[]]}\n"
+    " {\"seq\":2}\n";
+
+/* Every value as it was reported: depth, key or index, type and token */
+static const char expected_trace[] =
+    "0 - {\n"
+    "1 status 0 404\n"
+    "1 change 0 -1\n"
+    "1 rtc {\n"
+    "2 ms 0 5\n"
+    "1 rtc }\n"
+    // A \u escape is kept as a placeholder
+    "1 name 1 a\"b?\n\n"
+    "1 list [\n"
+    "2 #0 0 1\n"
+    "2 #1 0 2.5e3\n"
+    "2 #2 2 true\n"
+    "2 #3 3 false\n"
+    "2 #4 4 null\n"
+    "2 #5 [\n"
+    "2 #5 ]\n"
+    "1 list ]\n"
+    "0 - }\n"
+    "0 - {\n"
+    "1 seq 0 2\n"
+    "0 - }\n";
+
+static char trace[1024];
+static size_t trace_len;
+
+static void trace_cb(struct json_parser *p, enum json_type type, const char *value) {
+    char where[JSON_KEY_MAX + 8];
+    const char *key = json_key(p);
+
+    if (key != NULL) {
+        snprintf(where, sizeof(where), "%s", key);
+    } else if (json_index(p) >= 0) {
+        snprintf(where, sizeof(where), "#%d", json_index(p));
+    } else {
+        strcpy(where, "-");
+    }
+
+    static const char *containers[] = { "{", "}", "[", "]" };
+    int len;
+    if (type >= JSON_OBJECT_START) {
+        len = snprintf(trace + trace_len, sizeof(trace) - trace_len, "%d %s %s\n",
+                       p->depth, where, containers[type - JSON_OBJECT_START]);
+    } else {
+        len = snprintf(trace + trace_len, sizeof(trace) - trace_len, "%d %s %d %s\n",
+                       p->depth, where, type, value);
+    }
+    trace_len += len;
+    CHECK(trace_len < sizeof(trace));
+}
+
+/**
+ * Feed doc in pieces, cut at a and b, and check the same values come out
+ * as from the whole document.
+ */
+static void feed_split(size_t a, size_t b) {
+    struct json_parser parser;
+    size_t len = sizeof(doc) - 1;
+
+    trace_len = 0;
+    json_init(&parser, trace_cb, NULL);
+    CHECK(json_feed(&parser, doc, a) == 0);
+    CHECK(json_feed(&parser, doc + a, b - a) == 0);
+    CHECK(json_feed(&parser, doc + b, len - b) == 0);
+    trace[trace_len] = '\0';
+    CHECK(strcmp(trace, expected_trace) == 0);
+}
+
+static void check_every_split(void) {
+    size_t len = sizeof(doc) - 1;
+
+    for (size_t a = 0; a <= len && failures == 0; a++) {
+        for (size_t b = a; b <= len && failures == 0; b++) {
+            feed_split(a, b);
+        }
+    }
+    if (failures > 0) {
+        printf("got:\n%s", trace);
+    }
+}
+
+static void check_fields(void) {
+    int status = 0;
+    int change = 0;
+    int ms = 0;
+    double seq = 0;
+    struct json_field field_list[] = {
+        { "change", JSON_FIELD_INT, &change },
+        { "status", JSON_FIELD_INT, &status },
+        { "ms", JSON_FIELD_INT, &ms },
+        { "seq", JSON_FIELD_DOUBLE, &seq },
+    };
+    struct json_fields fields = { field_list, 4 };
+    struct json_parser parser;
+
+    // A byte at a time, the way the smallest recv() would hand it on
+    json_fields_init(&parser, &fields);
+    for (size_t i = 0; i < sizeof(doc) - 1; i++) {
+        CHECK(json_feed(&parser, doc + i, 1) == 0);
+    }
+    CHECK(field_list[0].found && change == -1);
+    CHECK(field_list[1].found && status == 404);
+    // Only the top level of each document is looked at
+    CHECK(!field_list[2].found && ms == 0);
+    CHECK(field_list[3].found && seq == 2.0);
+    CHECK(!json_fields_all_found(&fields));
+}
+
+static void check_malformed(void) {
+    // Only what shows at the byte it goes wrong; a stray token at the top
+    // level is found out at the delimiter after it
+    static const char *bad[] = {
+        "}\n",
+        "[1,]\n",
+        "{\"a\" 1}",
+        "{\"a\"::1}",
+        "{1:2}",
+        "[1 2]",
+        "{\"a\":1 \"b\":2}",
+        "{\"a\":tru}",
+        "{\"a\":[1}",
+    };
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        struct json_parser parser;
+        size_t len = strlen(bad[i]);
+
+        json_init(&parser, trace_cb, NULL);
+        trace_len = 0;
+        CHECK(json_feed(&parser, bad[i], len) == -EINVAL);
+
+        // The error sticks, whatever is fed after it
+        json_init(&parser, trace_cb, NULL);
+        trace_len = 0;
+        int ret = 0;
+        for (size_t j = 0; j < len; j++) {
+            ret = json_feed(&parser, bad[i] + j, 1);
+        }
+        CHECK(ret == -EINVAL);
+        CHECK(json_feed(&parser, "{}", 2) == -EINVAL);
+    }
+}
+
+int main(void) {
+    check_every_split();
+    check_fields();
+    check_malformed();
+    if (failures == 0) {
+        printf("json ok\n");
+    }
+    return failures != 0;
+}
@@ -0,0 +1,20 @@
+#ifndef HOST_ZEPHYR_NET_SOCKET_H_
+#define HOST_ZEPHYR_NET_SOCKET_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/* The zsock_ calls the base node makes, for the host build. Each test
+ * defines the ones it reaches, against a canned server.
+ */
+#define ZSOCK_MSG_PEEK MSG_PEEK
+#define ZSOCK_MSG_DONTWAIT MSG_DONTWAIT
+
+int zsock_close(int sock);
+ssize_t zsock_send(int sock, const void *buf, size_t len, int flags);
+ssize_t zsock_recv(int sock, void *buf, size_t len, int flags);
+int zsock_setsockopt(int sock, int level, int optname, const void *optval, socklen_t optlen);
+
+#endif
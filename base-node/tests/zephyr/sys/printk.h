@@ -0,0 +1,8 @@
+#ifndef HOST_ZEPHYR_SYS_PRINTK_H_
+#define HOST_ZEPHYR_SYS_PRINTK_H_
+
+#include <stdio.h>
+
+#define printk printf
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef HOST_ZEPHYR_SYS_UTIL_H_
+#define HOST_ZEPHYR_SYS_UTIL_H_
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+#endif
@@ -1,5 +1,5 @@
 from fastapi import FastAPI, WebSocket
-from fastapi.responses import HTMLResponse
+from fastapi.responses import HTMLResponse, Response, StreamingResponse
 from pydantic import BaseModel
 import uvicorn
 import time
@@ -10,6 +10,8 @@ import threading
 import os
 import asyncio
 import json
+import struct
+import collections
 
 rootpath = os.path.dirname(os.path.abspath(__file__))
 
@@ -18,6 +20,10 @@ MQTT_PORT = 1883
 MQTT_TOPIC = "discotest"
 
 MQTT_ULTRASONIC_TOPIC = "esp32/receive"
+# Binary events straight from a networked ml_ultrasonic build
+MQTT_GESTURE_TOPIC = "zephyrus/green/ultrasonic/gesture"
+# seq, sample_ms, sent_ms, category, see ml_ultrasonic/include/mqtt.h
+GESTURE_FORMAT = "<IIIB"
 MQTT_SPEAKER_TOPIC = "zephyrus/green/speaker"
 
 logging.basicConfig(level=logging.INFO, format="%(asctime)s [%(levelname)s] %(message)s")
@@ -183,6 +189,148 @@ async def get_ferry():
     }
 
 
+# Every position sent to the base node, numbered so a /ferry/stream client
+# that reconnects with ?since=<seq> resumes without losing any
+FERRY_UPDATE_HISTORY = 256
+# Most positions in one batch, FERRY_BATCH_MAX in base-node/src/ferry_feed.h
+FERRY_BATCH_MAX = 12
+# Empty batch sent on an idle stream so the base node knows it is still up
+FERRY_STREAM_KEEPALIVE = 15
+
+# Binary framing served by the .bin endpoints, struct ferry_frame_header
+# and struct ferry_record in base-node/src/ferry_feed.h
+FERRY_FRAME_MAGIC = 0x4246  # "FB"
+FERRY_FRAME_HEADER_FORMAT = "<HHI"
+FERRY_RECORD_FORMAT = "<IiiIHH"
+# Record is the ferry's current position from a snapshot, not a new move
+FERRY_RECORD_SNAPSHOT = 0x0001
+
+# (seq, mmsi, lat, lon, unix time)
+ferry_updates = collections.deque(maxlen=FERRY_UPDATE_HISTORY)
+ferry_update_seq = 0
+ferry_update_lock = threading.Lock()
+# Set and replaced on each update, waking every open stream
+ferry_update_event = None
+event_loop = None
+
+
+@app.on_event("startup")
+async def capture_event_loop():
+    global event_loop, ferry_update_event
+    event_loop = asyncio.get_running_loop()
+    ferry_update_event = asyncio.Event()
+
+
+def wake_ferry_streams():
+    global ferry_update_event
+    ferry_update_event.set()
+    ferry_update_event = asyncio.Event()
+
+
+def publish_ferry_update(mmsi, lat, lon):
+    global ferry_update_seq
+    with ferry_update_lock:
+        ferry_update_seq += 1
+        ferry_updates.append((ferry_update_seq, mmsi, lat, lon, int(time.time())))
+    if event_loop is not None:
+        event_loop.call_soon_threadsafe(wake_ferry_streams)
+
+
+def encode_ferry_batch(seq, positions):
+    """One compact line, {"seq":<last seq>,"ferries":[[mmsi,lat,lon],...]},
+    in the key order the base node parses. 6 decimal places is 0.1 m."""
+    ferries = [[mmsi, round(lat, 6), round(lon, 6)] for mmsi, lat, lon, _, _ in positions]
+    return json.dumps({"seq": seq, "ferries": ferries}, separators=(",", ":")) + "\n"
+
+
+def encode_ferry_frame(seq, positions):
+    """The same batch as a frame header and fixed 20 byte records with
+    microdegree coordinates, which the base node uses as is."""
+    frame = struct.pack(FERRY_FRAME_HEADER_FORMAT, FERRY_FRAME_MAGIC, len(positions), seq)
+    for mmsi, lat, lon, timestamp, flags in positions:
+        frame += struct.pack(FERRY_RECORD_FORMAT, mmsi, round(lat * 1e6), round(lon * 1e6),
+                             timestamp, flags, 0)
+    return frame
+
+
+def pending_ferry_updates(since):
+    """Up to FERRY_BATCH_MAX updates after since, as (seq, position)."""
+    with ferry_update_lock:
+        pending = [u for u in ferry_updates if u[0] > since][:FERRY_BATCH_MAX]
+    return [(seq, (mmsi, lat, lon, timestamp, 0)) for seq, mmsi, lat, lon, timestamp in pending]
+
+
+def resume_point(since):
+    # Without since, start at the next update; a since from before a
+    # server restart is past the end and starts there too
+    return ferry_update_seq if since < 0 or since > ferry_update_seq else since
+
+
+def ferry_batches(since):
+    """Every position after since, at most FERRY_BATCH_MAX, as one batch.
+    Without since, the latest position of each ferry to start from, split
+    into batches of FERRY_BATCH_MAX that all carry the current seq."""
+    if since < 0:
+        now = int(time.time())
+        with ferry_update_lock:
+            seq = ferry_update_seq
+            snapshot = [(p["mmsi"], p["lat"], p["lon"], now, FERRY_RECORD_SNAPSHOT)
+                        for p in current_position_data]
+        # At least one batch, even if empty, so the base node gets the seq
+        return [(seq, snapshot[i:i + FERRY_BATCH_MAX])
+                for i in range(0, max(len(snapshot), 1), FERRY_BATCH_MAX)]
+    pending = pending_ferry_updates(resume_point(since))
+    seq = pending[-1][0] if pending else resume_point(since)
+    return [(seq, [position for _, position in pending])]
+
+
+def ferry_stream(since, encode, media_type):
+    last = resume_point(since)
+
+    async def batches():
+        nonlocal last
+        with ferry_update_lock:
+            if ferry_updates and ferry_updates[0][0] > last + 1:
+                logger.warning(f"Ferry stream lost {ferry_updates[0][0] - last - 1} updates")
+        while True:
+            event = ferry_update_event
+            pending = pending_ferry_updates(last)
+            if pending:
+                # Everything that arrived since the last wake goes in one batch
+                last = pending[-1][0]
+                yield encode(last, [position for _, position in pending])
+                continue
+            try:
+                await asyncio.wait_for(event.wait(), FERRY_STREAM_KEEPALIVE)
+            except asyncio.TimeoutError:
+                yield encode(last, [])
+
+    logger.info(f"Base node ferry stream opened from seq {last}")
+    return StreamingResponse(batches(), media_type=media_type)
+
+
+@app.get("/ferry/batch")
+async def get_ferry_batch(since: int = -1):
+    return Response("".join(encode_ferry_batch(*batch) for batch in ferry_batches(since)),
+                    media_type="application/json")
+
+
+@app.get("/ferry/batch.bin")
+async def get_ferry_batch_bin(since: int = -1):
+    return Response(b"".join(encode_ferry_frame(*batch) for batch in ferry_batches(since)),
+                    media_type="application/octet-stream")
+
+
+@app.get("/ferry/stream")
+async def stream_ferry(since: int = -1):
+    return ferry_stream(since, encode_ferry_batch, "application/x-ndjson")
+
+
+@app.get("/ferry/stream.bin")
+async def stream_ferry_bin(since: int = -1):
+    return ferry_stream(since, encode_ferry_frame, "application/octet-stream")
+
+
 # a 1 means increase, 0 means decrease
 volume_changes = []
 
@@ -263,6 +411,17 @@ def send_departure_to_speaker():
     client.publish(MQTT_SPEAKER_TOPIC, payload="Depart", qos=1)
 
 
+class ClipReq(BaseModel):
+    clip: int
+
+@app.post("/clip")
+async def play_clip(req: ClipReq):
+    # Index into the clip image packed by speaker-node/scripts/pack_clips.py
+    logger.info(f"Sending clip {req.clip} to speaker")
+    client.publish(MQTT_SPEAKER_TOPIC, payload=f"Clip {req.clip}", qos=1)
+    return {"status": "ok"}
+
+
 class FerryStatusReq(BaseModel):
     mmsi: int
 
@@ -287,8 +446,46 @@ async def show_dashboard():
         return HTMLResponse(f.read())
 
 
+# Smallest (arrival - sent_ms) seen, the device uptime offset plus the
+# fastest network path. Network latency is measured against it.
+gesture_clock_offset = None
+last_gesture_seq = None
+
+
+def on_gesture_event(payload):
+    global gesture_clock_offset, last_gesture_seq
+    arrival_ms = int(time.time() * 1000)
+    seq, sample_ms, sent_ms, category = struct.unpack(GESTURE_FORMAT, payload)
+
+    if last_gesture_seq is not None and seq != last_gesture_seq + 1:
+        if seq > last_gesture_seq:
+            logger.warning(f"Lost {seq - last_gesture_seq - 1} gesture events")
+        else:
+            # The node restarted, its uptime clock did too
+            gesture_clock_offset = None
+    last_gesture_seq = seq
+
+    offset = arrival_ms - sent_ms
+    if gesture_clock_offset is None or offset < gesture_clock_offset:
+        gesture_clock_offset = offset
+    logger.info(f"Gesture {category} seq {seq}: {sent_ms - sample_ms} ms on device, "
+                f"+{offset - gesture_clock_offset} ms over the fastest network path")
+
+    if category == 1:
+        volume_changes.append(0)
+    elif category == 2:
+        volume_changes.append(1)
+
+
 def on_message_from_ultrasonic(client, userdata, message):
     global volume_changes
+    if message.topic == MQTT_GESTURE_TOPIC:
+        if len(message.payload) != struct.calcsize(GESTURE_FORMAT):
+            logger.warning(f"Bad gesture payload length {len(message.payload)}")
+            return
+        on_gesture_event(message.payload)
+        return
+
     logger.info(f"Payload: {message.payload.decode()}")
     content = message.payload.decode()
 
@@ -300,7 +497,8 @@ def on_message_from_ultrasonic(client, userdata, message):
 
 
 def mqtt_sub_thread():
-    subscribe.callback(on_message_from_ultrasonic, topics=MQTT_ULTRASONIC_TOPIC, hostname=MQTT_BROKER)
+    subscribe.callback(on_message_from_ultrasonic, topics=[MQTT_ULTRASONIC_TOPIC, MQTT_GESTURE_TOPIC],
+                       hostname=MQTT_BROKER)
 
 # Global list of dictionaries for each ferry being displayed
 # Each dictionary should contain {"mmsi": int, "lat": int, "lon": int}
@@ -362,6 +560,7 @@ def supply_ferry_data_thread():
                 }
             # FOR BASENODE: Append a list to the queue [MMSI, LAT, LONG]  
             ferry_data_queue.append([mmsi, lat, long])
+            publish_ferry_update(mmsi, lat, long)
 
             if len(ferry_data_queue) >= 24:
                 # Assert ferry_data_queue has 6 or more elements
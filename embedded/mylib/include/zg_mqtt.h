@@ -0,0 +1,45 @@
+#ifndef ZG_MQTT_H_
+#define ZG_MQTT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/net/mqtt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* A received message whose payload is still on the socket */
+    struct zg_mqtt_message;
+
+    /* Called on the MQTT thread for each message on a subscribed topic,
+     * with len payload bytes waiting. The callback reads them with
+     * zg_mqtt_read() straight into its own buffers, in as many pieces as
+     * it likes, so messages of any size arrive without passing through a
+     * library buffer. Bytes left unread are dropped when it returns.
+     */
+    typedef void (*zg_mqtt_rx_cb_t)(const char *topic, struct zg_mqtt_message *msg, size_t len,
+                                    void *user_data);
+
+    /* Only from within a zg_mqtt_rx_cb_t, on the msg it was given. Returns
+     * 0 once len bytes are in buf, -EMSGSIZE if fewer are left, or another
+     * negative errno if the connection failed.
+     */
+    int zg_mqtt_read(struct zg_mqtt_message *msg, void *buf, size_t len);
+
+    /* Register before zg_mqtt_start(); topic must stay valid for good */
+    int zg_mqtt_subscribe(const char *topic, enum mqtt_qos qos, zg_mqtt_rx_cb_t cb, void *user_data);
+    void zg_mqtt_start(void);
+
+    /* Queue a message, from any thread but not from an ISR. topic must stay
+     * valid until the message has been delivered; payload is copied.
+     */
+    int zg_mqtt_publish(const char *topic, const void *payload, size_t len, enum mqtt_qos qos);
+    bool zg_mqtt_connected(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,35 +1,78 @@
-
 #include <zephyr/kernel.h>
 #include <zephyr/net/socket.h>
 #include <zephyr/net/mqtt.h>
-#include <zephyr/net/wifi_mgmt.h>
 #include <zephyr/net/dns_resolve.h>
-#include <zephyr/net/net_mgmt.h>
-#include <zephyr/net/net_event.h>
-#include <zephyr/net/net_if.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/printk.h>
+#include <sys/eventfd.h>
+#include <errno.h>
 #include <string.h>
-#include <zephyr/drivers/rtc.h>
-#include <hive.h>
-
-
-
-
-#define HIVEMQ_PORT 8883
-
-#define CLIENT_ID "esp32c3_mqtt_client"
-
-#define MQTT_PUBLISH_TOPIC "esp32/data"
-#define MQTT_SUBSCRIBE_TOPIC "esp32/receive"
-
-#define MQTT_THREAD_STACK_SIZE 8192
-#define MQTT_PRIORITY 4
+#include <stdio.h>
+#include <zg_mqtt.h>
 
-#define HIVEMQ_CERTIFICATE_TAG 1
+#ifdef CONFIG_WIFI
+#include <zephyr/net/wifi_mgmt.h>
+#include <zephyr/net/net_mgmt.h>
+#include <zephyr/net/net_event.h>
+#include <zephyr/net/net_if.h>
+#endif
+
+#ifdef CONFIG_ZG_MQTT_TLS
+#include <zephyr/net/tls_credentials.h>
+#endif
+
+struct subscription {
+    const char *topic;
+    enum mqtt_qos qos;
+    zg_mqtt_rx_cb_t cb;
+    void *user_data;
+};
+
+struct outbound {
+    const char *topic;
+    uint16_t len;
+    uint8_t qos;
+    uint8_t payload[CONFIG_ZG_MQTT_TX_PAYLOAD_SIZE];
+};
+
+/* A QoS 1 message sent but not yet acknowledged */
+struct inflight {
+    uint16_t message_id;    /* 0 while the slot is free */
+    uint32_t sent_ms;
+    struct outbound msg;
+};
+
+/* The payload of the message being handed to a subscriber */
+struct zg_mqtt_message {
+    size_t left;
+};
+
+static uint8_t rx_buff[CONFIG_ZG_MQTT_BUFFER_SIZE];
+static uint8_t tx_buff[CONFIG_ZG_MQTT_BUFFER_SIZE];
 
-#define RTC_NODE DT_NODELABEL(rtc)
+static struct mqtt_client client;
+static struct sockaddr_storage broker;
+/* fds[0] is the broker socket, fds[1] the eventfd raised by zg_mqtt_publish() */
+static struct zsock_pollfd fds[2];
+static int wake_fd = -1;
+static atomic_t connected;
+static atomic_t started;
+static uint16_t last_message_id;
+
+static struct subscription subscriptions[CONFIG_ZG_MQTT_MAX_SUBSCRIPTIONS];
+static size_t subscription_count;
+
+static struct inflight inflight[CONFIG_ZG_MQTT_MAX_INFLIGHT];
+/* Taken off the queue but waiting for an inflight slot */
+static struct outbound held;
+static bool held_valid;
+
+K_MSGQ_DEFINE(outbound_msgq, sizeof(struct outbound), CONFIG_ZG_MQTT_TX_QUEUE_LEN, 4);
+K_SEM_DEFINE(start_sem, 0, 1);
+K_SEM_DEFINE(dns_sem, 0, 1);
 
-static const char hive_cert[] =
+#ifdef CONFIG_ZG_MQTT_TLS_ISRG_ROOT
+static const char isrg_root_x1[] =
     "-----BEGIN CERTIFICATE-----\n"
     "MIIFazCCA1OgAwIBAgIRAIIQz7DSQONZRGPgu2OCiwAwDQYJKoZIhvcNAQELBQAw\n"
     "TzELMAkGA1UEBhMCVVMxKTAnBgNVBAoTIEludGVybmV0IFNlY3VyaXR5IFJlc2Vh\n"
@@ -61,79 +104,33 @@ static const char hive_cert[] =
     "mRGunUHBcnWEvgJBQl9nJEiU0Zsnvgc/ubhPgXRR4Xq37Z0j4r7g1SgEEzwxA57d\n"
     "emyPxgcYxn/eR44/KJ4EBs+lVDR3veyJm+kXQ99b21/+jh5Xos1AnX5iItreGCc=\n"
     "-----END CERTIFICATE-----\n";
+#endif
 
-static uint8_t rx_buff[32];
-static uint8_t tx_buff[32];
-
-static struct mqtt_client client;
-static struct sockaddr_storage broker;
-static struct pollfd fds[1];
-static int nfds;
-
+#ifdef CONFIG_WIFI
+K_SEM_DEFINE(wifi_sem, 0, 1);
 static struct net_mgmt_event_callback wifi_cb;
 
-K_SEM_DEFINE(mqtt_sem, 0, 1);
-K_SEM_DEFINE(dns_sem, 0, 1);
-const struct device *rtc_dev;
-K_MUTEX_DEFINE(rtc_mutex);
-
-void set_rtc_time(struct rtc_time *time) {
-    k_mutex_lock(&rtc_mutex, K_FOREVER);
-    rtc_set_time(rtc_dev, time);
-    k_mutex_unlock(&rtc_mutex);
-    printf("RTC time set to: %04d-%02d-%02d %02d:%02d:%02d\n",
-        time->tm_year + 1900,
-        time->tm_mon + 1,
-        time->tm_mday,
-        time->tm_hour,
-        time->tm_min,
-        time->tm_sec
-    );
-}
-
-void init_rtc(void) {
-    // init RTC device
-    rtc_dev = DEVICE_DT_GET(RTC_NODE);
-    if (rtc_dev == NULL) {
-        printf("Failed to get RTC device\n");
-        return;
-    }
-    // set initial time
-    struct rtc_time set_time = {
-        .tm_year = 2025 - 1900,  // Year since 1900
-        .tm_mon = 5 - 1,         // Month (0-based)
-        .tm_mday = 23,           // Day
-        .tm_hour = 10,           // Hour
-        .tm_min = 20,            // Minute
-        .tm_sec = 0              // Second
-    };
-    set_rtc_time(&set_time);
-    printf("RTC initialised");
-}
-
 static void wifi_event_handler(struct net_mgmt_event_callback *cb, uint32_t mgmt_event, struct net_if *iface) {
     if (mgmt_event == NET_EVENT_IPV4_ADDR_ADD) {
         printf("WiFi connected!\n");
-        k_sem_give(&mqtt_sem);
+        k_sem_give(&wifi_sem);
     }
 }
 
 static int connect_wifi(void) {
-    
     static struct wifi_connect_req_params params;
-    
+
     struct net_if *iface = net_if_get_default();
     net_mgmt_init_event_callback(&wifi_cb, wifi_event_handler, NET_EVENT_IPV4_ADDR_ADD);
     net_mgmt_add_event_callback(&wifi_cb);
-    printf("Setting up connection\n");
     if (!iface) {
         printf("No default network interface available\n");
-        return -1;
+        return -ENODEV;
     }
-    params.ssid = WIFI_ID;
-    params.ssid_length = strlen(WIFI_ID);
-    params.psk = WIFI_PASSWORD;
-    params.psk_length = strlen(WIFI_PASSWORD);
+    params.ssid = CONFIG_ZG_MQTT_WIFI_SSID;
+    params.ssid_length = strlen(CONFIG_ZG_MQTT_WIFI_SSID);
+    params.psk = CONFIG_ZG_MQTT_WIFI_PSK;
+    params.psk_length = strlen(CONFIG_ZG_MQTT_WIFI_PSK);
     params.channel = WIFI_CHANNEL_ANY;
     params.security = WIFI_SECURITY_TYPE_PSK;
     params.mfp = WIFI_MFP_OPTIONAL;
@@ -143,281 +140,467 @@ static int connect_wifi(void) {
         printk("WiFi connection request failed: %d\n", ret);
         return ret;
     }
-    k_sem_take(&mqtt_sem, K_FOREVER);
-    if (ret) {
-        printf("Timeout waiting for IP address\n");
-        return -2;
-    }
-    printf("Connected to WiFi network: %s\n", WIFI_ID);
+    // Wait for DHCP, the broker lookup needs an address
+    k_sem_take(&wifi_sem, K_FOREVER);
+    printf("Connected to WiFi network: %s\n", CONFIG_ZG_MQTT_WIFI_SSID);
     return 0;
 }
+#endif
 
-void dns_result_cb(enum dns_resolve_status status, struct dns_addrinfo *info, void *user_data) {
-	char hr_addr[NET_IPV4_ADDR_LEN];
-	char *hr_family;
-	void *addr;
-    printf("Resolving ...\n");
-	switch (status) {
-	case DNS_EAI_CANCELED:
-		printf("DNS query was canceled\n");
-		return;
-	case DNS_EAI_FAIL:
-		printf("DNS resolve failed\n");
-		return;
-	case DNS_EAI_NODATA:
-		printf("Cannot resolve address\n");
-		return;
-	case DNS_EAI_ALLDONE:
-		printf("DNS resolving finished\n");
+static void dns_result_cb(enum dns_resolve_status status, struct dns_addrinfo *info, void *user_data) {
+    if (status == DNS_EAI_ALLDONE || status == DNS_EAI_FAIL || status == DNS_EAI_NODATA ||
+        status == DNS_EAI_CANCELED) {
         k_sem_give(&dns_sem);
-		return;
-	case DNS_EAI_INPROGRESS:
-		break;
-	default:
-		printf("DNS resolving error (%d)\n", status);
-		return;
-	}
-
-	if (!info) {
-		return;
-	}
-
-	if (info->ai_family == AF_INET) {
-		hr_family = "IPv4";
-		addr = &net_sin(&info->ai_addr)->sin_addr;
-        struct sockaddr_in *broker_addr = (struct sockaddr_in *)&broker;
-        broker_addr->sin_family = AF_INET;
-        broker_addr->sin_port = htons(HIVEMQ_PORT);
-        memcpy(&broker_addr->sin_addr, &net_sin(&info->ai_addr)->sin_addr, sizeof(struct in_addr));
-        net_addr_ntop(AF_INET, &broker_addr->sin_addr, hr_addr, sizeof(hr_addr));
-        printf("Resolved %s to IPv4 address: %s\n", HIVEMQ_HOSTNAME, hr_addr);
-	} else if (info->ai_family == AF_INET6) {
-		hr_family = "IPv6";
-		addr = &net_sin6(&info->ai_addr)->sin6_addr;
-	} else {
-		printf("Invalid IP address family %d\n", info->ai_family);
-		return;
-	}
-
-	printf("%s %s address: %s\n", user_data ? (char *)user_data : "<null>",
-		hr_family, net_addr_ntop(info->ai_family, addr, hr_addr, sizeof(hr_addr)));
+        return;
+    }
+    if (status != DNS_EAI_INPROGRESS || !info || info->ai_family != AF_INET) {
+        return;
+    }
+    struct sockaddr_in *broker_addr = (struct sockaddr_in *)&broker;
+    memcpy(&broker_addr->sin_addr, &net_sin(&info->ai_addr)->sin_addr, sizeof(struct in_addr));
 }
 
-int resolve_dns(void) {
-    printf("Attempting to resolve hostname: %s\n", HIVEMQ_HOSTNAME);
-    struct dns_resolve_context *dns_ctx = dns_resolve_get_default();
-    if (!dns_ctx) {
-        printk("Error: DNS context not available\n");
-        return -4;
+static int resolve_broker(void) {
+    struct sockaddr_in *broker_addr = (struct sockaddr_in *)&broker;
+
+    memset(&broker, 0, sizeof(broker));
+    broker_addr->sin_family = AF_INET;
+    broker_addr->sin_port = htons(CONFIG_ZG_MQTT_BROKER_PORT);
+
+    // A literal address, e.g. a local broker, needs no lookup
+    if (zsock_inet_pton(AF_INET, CONFIG_ZG_MQTT_BROKER_HOSTNAME, &broker_addr->sin_addr) == 1) {
+        return 0;
     }
-    printf("DNS Servers configured:\n");
-    int ret = dns_get_addr_info(HIVEMQ_HOSTNAME, DNS_QUERY_TYPE_A, NULL, dns_result_cb, (void*)HIVEMQ_HOSTNAME, 10000);
+
+    printf("Attempting to resolve hostname: %s\n", CONFIG_ZG_MQTT_BROKER_HOSTNAME);
+    int ret = dns_get_addr_info(CONFIG_ZG_MQTT_BROKER_HOSTNAME, DNS_QUERY_TYPE_A, NULL,
+                                dns_result_cb, NULL, 10000);
     if (ret) {
         printf("Resolving Address Failed\n");
         return ret;
     }
+    k_sem_take(&dns_sem, K_FOREVER);
+    if (broker_addr->sin_addr.s_addr == 0) {
+        printf("Cannot resolve %s\n", CONFIG_ZG_MQTT_BROKER_HOSTNAME);
+        return -EHOSTUNREACH;
+    }
+    return 0;
+}
+
+/**
+ * MQTT packet identifiers must be non-zero and unique among packets in
+ * flight, so hand them out in sequence.
+ */
+static uint16_t next_message_id(void) {
+    if (++last_message_id == 0) {
+        last_message_id = 1;
+    }
+    return last_message_id;
+}
 
-    ret = k_sem_take(&dns_sem, K_FOREVER);
-    struct sockaddr_in *broker_addr = (struct sockaddr_in *)&broker;
-    char addr_str[NET_IPV4_ADDR_LEN];
-    net_addr_ntop(AF_INET, &broker_addr->sin_addr, addr_str, sizeof(addr_str));
-    printf("Successfully resolved %s to %s\n", HIVEMQ_HOSTNAME, addr_str);
+static int send_message(const struct outbound *msg, uint16_t message_id, bool dup) {
+    struct mqtt_publish_param param;
+
+    param.message.topic.qos = msg->qos;
+    param.message.topic.topic.utf8 = (uint8_t *)msg->topic;
+    param.message.topic.topic.size = strlen(msg->topic);
+    param.message.payload.data = (uint8_t *)msg->payload;
+    param.message.payload.len = msg->len;
+    param.message_id = message_id;
+    param.dup_flag = dup;
+    param.retain_flag = 0;
+
+    return mqtt_publish(&client, &param);
+}
+
+static struct inflight *find_inflight(uint16_t message_id) {
+    for (int i = 0; i < ARRAY_SIZE(inflight); i++) {
+        if (inflight[i].message_id == message_id) {
+            return &inflight[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Send everything queued that the inflight window allows. QoS 1 messages
+ * keep their slot until the PUBACK, so a full window leaves the rest queued
+ * rather than sending more than the broker has acknowledged.
+ */
+static int flush_outbound(void) {
+    eventfd_t count;
+
+    eventfd_read(wake_fd, &count);
+    while (1) {
+        if (!held_valid) {
+            if (k_msgq_get(&outbound_msgq, &held, K_NO_WAIT) != 0) {
+                return 0;
+            }
+            held_valid = true;
+        }
+
+        if (held.qos == MQTT_QOS_0_AT_MOST_ONCE) {
+            held_valid = false;
+            int ret = send_message(&held, 0, false);
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+
+        struct inflight *slot = find_inflight(0);
+        if (!slot) {
+            return 0;
+        }
+        slot->msg = held;
+        slot->message_id = next_message_id();
+        slot->sent_ms = k_uptime_get_32();
+        held_valid = false;
+        // Kept in its slot on failure, resent once reconnected
+        int ret = send_message(&slot->msg, slot->message_id, false);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+}
+
+/**
+ * Resend unacknowledged QoS 1 messages, all of them after a reconnect or
+ * only the overdue ones otherwise. Returns ms until the next one is due.
+ */
+static int retry_inflight(bool all) {
+    uint32_t now = k_uptime_get_32();
+    int next_due = SYS_FOREVER_MS;
+
+    for (int i = 0; i < ARRAY_SIZE(inflight); i++) {
+        struct inflight *slot = &inflight[i];
+        if (slot->message_id == 0) {
+            continue;
+        }
+        uint32_t age = now - slot->sent_ms;
+        if (all || age >= CONFIG_ZG_MQTT_RETRY_MS) {
+            send_message(&slot->msg, slot->message_id, true);
+            slot->sent_ms = now;
+            age = 0;
+        }
+        int due = CONFIG_ZG_MQTT_RETRY_MS - age;
+        if (next_due == SYS_FOREVER_MS || due < next_due) {
+            next_due = due;
+        }
+    }
+    return next_due;
+}
+
+/**
+ * Read the next len bytes of a message's payload into buf, straight off the
+ * socket. Only valid from within a subscription callback.
+ */
+int zg_mqtt_read(struct zg_mqtt_message *msg, void *buf, size_t len) {
+    if (len > msg->left) {
+        return -EMSGSIZE;
+    }
+    int ret = mqtt_readall_publish_payload(&client, buf, len);
+    if (ret < 0) {
+        // Nothing more can be read once the stream is out of step
+        msg->left = 0;
+        return ret;
+    }
+    msg->left -= len;
     return 0;
 }
 
+/**
+ * Hand a received message to its subscriber, which reads the payload off
+ * the socket into its own buffers. Whatever it leaves is read and dropped
+ * so the stream stays in sync.
+ */
+static void handle_publish(const struct mqtt_publish_param *pub) {
+    const struct mqtt_utf8 *topic = &pub->message.topic.topic;
+    struct zg_mqtt_message msg = {
+        .left = pub->message.payload.len,
+    };
+
+    for (int i = 0; i < subscription_count; i++) {
+        const struct subscription *sub = &subscriptions[i];
+        if (strlen(sub->topic) == topic->size &&
+            memcmp(sub->topic, topic->utf8, topic->size) == 0) {
+            sub->cb(sub->topic, &msg, msg.left, sub->user_data);
+            break;
+        }
+    }
+
+    while (msg.left > 0) {
+        uint8_t discard[32];
+        if (zg_mqtt_read(&msg, discard, MIN(msg.left, sizeof(discard))) < 0) {
+            printf("Failed to read MQTT payload\n");
+            return;
+        }
+    }
+
+    if (pub->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE) {
+        struct mqtt_puback_param puback = {
+            .message_id = pub->message_id,
+        };
+        mqtt_publish_qos1_ack(&client, &puback);
+    }
+}
 
 static void mqtt_event_handler(struct mqtt_client *client_ptr, const struct mqtt_evt *evt) {
-    struct mqtt_puback_param puback;
-    struct mqtt_pubrec_param pubrec;
-    struct mqtt_pubrel_param pubrel;
-    struct mqtt_pubcomp_param pubcomp;
     if (evt->type == MQTT_EVT_CONNACK) {
         if (evt->result != 0) {
-			printf("Connection failed with status %d\n", evt->result);
-		} else {
-			printf("Client connected\n");
-		}
+            printf("Connection failed with status %d\n", evt->result);
+        } else {
+            printf("Client connected\n");
+            atomic_set(&connected, 1);
+        }
     } else if (evt->type == MQTT_EVT_DISCONNECT) {
         printf("Client disconnected\n");
+        atomic_set(&connected, 0);
     } else if (evt->type == MQTT_EVT_PUBACK) {
-        printf("PUBACK received for message ID %u\n", evt->param.puback.message_id);
-    } else if (evt->type == MQTT_EVT_PUBREC) {
-        printf("PUBREC received for message ID %u\n", evt->param.pubrec.message_id);
-    } else if (evt->type == MQTT_EVT_PUBLISH) {
-        const struct mqtt_publish_param *pub = &evt->param.publish;
-        uint16_t message_length = pub->message.payload.len;
-
-        printk("MQTT PUBLISH received: id=%d, qos=%d, length=%d\n",
-               pub->message_id, pub->message.topic.qos, message_length);
-
-        if (message_length > sizeof(rx_buff)) {
-            message_length = sizeof(rx_buff);
+        struct inflight *slot = find_inflight(evt->param.puback.message_id);
+        if (slot) {
+            slot->message_id = 0;
         }
+    } else if (evt->type == MQTT_EVT_SUBACK) {
+        printf("SUBACK received for message ID %u\n", evt->param.suback.message_id);
+    } else if (evt->type == MQTT_EVT_PUBLISH) {
+        handle_publish(&evt->param.publish);
+    }
+}
 
-        /* Copy the received message to our buffer */
-        int ret = mqtt_read_publish_payload(&client, rx_buff, message_length);
-        if (ret < 0) {
-            printf("Failed to read MQTT payload: %d\n", ret);
-        }
+static int subscribe_all(void) {
+    struct mqtt_topic topics[CONFIG_ZG_MQTT_MAX_SUBSCRIPTIONS];
+    struct mqtt_subscription_list subscription;
 
-        /* Null terminate the message for easier printing */
-        rx_buff[message_length] = '\0';
-        printk("Received: %s\n", rx_buff);
-        /* Handle QoS levels */
-        if (pub->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE) {
-            //puback.message_id = pub->message_id;
-            //mqtt_publish_qos1_ack(client, &puback);
-        }
-    } else {
-        printf("Invalid Event Type\n");
+    if (subscription_count == 0) {
+        return 0;
     }
+    for (int i = 0; i < subscription_count; i++) {
+        topics[i].topic.utf8 = (uint8_t *)subscriptions[i].topic;
+        topics[i].topic.size = strlen(subscriptions[i].topic);
+        topics[i].qos = subscriptions[i].qos;
+        printf("Subscribing to topic: %s\n", subscriptions[i].topic);
+    }
+    subscription.list = topics;
+    subscription.list_count = subscription_count;
+    subscription.message_id = next_message_id();
+    return mqtt_subscribe(&client, &subscription);
 }
 
-int broker_connect(void) {
-
-    int ret = resolve_dns();
-    if (ret) {
+static int broker_connect(void) {
+    int ret = resolve_broker();
+    if (ret < 0) {
         return ret;
     }
 
     mqtt_client_init(&client);
     client.broker = &broker;
     client.evt_cb = mqtt_event_handler;
-    client.client_id.utf8 = (uint8_t *)CLIENT_ID;
-    client.client_id.size = strlen(CLIENT_ID);
+    client.client_id.utf8 = (uint8_t *)CONFIG_ZG_MQTT_CLIENT_ID;
+    client.client_id.size = strlen(CONFIG_ZG_MQTT_CLIENT_ID);
     client.protocol_version = MQTT_VERSION_3_1_1;
     client.rx_buf = rx_buff;
-	client.rx_buf_size = ARRAY_SIZE(rx_buff);
-	client.tx_buf = tx_buff;
-	client.tx_buf_size = ARRAY_SIZE(tx_buff);
-    client.transport.tls.config.peer_verify = 2;
-    //client.transport.tls.config.peer_verify = TLS_PEER_VERIFY_REQUIRED;
-    client.transport.tls.config.cipher_list = NULL;
-    client.transport.tls.config.sec_tag_list = (sec_tag_t []){ HIVEMQ_CERTIFICATE_TAG };
-    client.transport.tls.config.sec_tag_count = 1;
-    client.transport.tls.config.hostname = HIVEMQ_HOSTNAME;
+    client.rx_buf_size = ARRAY_SIZE(rx_buff);
+    client.tx_buf = tx_buff;
+    client.tx_buf_size = ARRAY_SIZE(tx_buff);
 
-    struct mqtt_utf8 username = {
-        .utf8 = (uint8_t *)HIVEMQ_USERNAME,
-        .size = strlen(HIVEMQ_USERNAME)
+    static struct mqtt_utf8 username = {
+        .utf8 = (uint8_t *)CONFIG_ZG_MQTT_USERNAME,
+        .size = sizeof(CONFIG_ZG_MQTT_USERNAME) - 1,
     };
-    struct mqtt_utf8 password = {
-        .utf8 = (uint8_t *)HIVEMQ_PASSWORD,
-        .size = strlen(HIVEMQ_PASSWORD)
+    static struct mqtt_utf8 password = {
+        .utf8 = (uint8_t *)CONFIG_ZG_MQTT_PASSWORD,
+        .size = sizeof(CONFIG_ZG_MQTT_PASSWORD) - 1,
     };
+    client.user_name = username.size ? &username : NULL;
+    client.password = password.size ? &password : NULL;
 
-    client.password = &password;
-	client.user_name = &username;
+#ifdef CONFIG_ZG_MQTT_TLS
+    static sec_tag_t sec_tags[] = { CONFIG_ZG_MQTT_TLS_SEC_TAG };
     client.transport.type = MQTT_TRANSPORT_SECURE;
+    client.transport.tls.config.peer_verify = TLS_PEER_VERIFY_REQUIRED;
+    client.transport.tls.config.cipher_list = NULL;
+    client.transport.tls.config.sec_tag_list = sec_tags;
+    client.transport.tls.config.sec_tag_count = ARRAY_SIZE(sec_tags);
+    client.transport.tls.config.hostname = CONFIG_ZG_MQTT_BROKER_HOSTNAME;
+#else
+    client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+#endif
+
     ret = mqtt_connect(&client);
-    if (ret < 0) {
+    if (ret != 0) {
         printf("Failed to connect to MQTT broker: %d\n", ret);
         return ret;
     }
+
+#ifdef CONFIG_ZG_MQTT_TLS
+    fds[0].fd = client.transport.tls.sock;
+#else
+    fds[0].fd = client.transport.tcp.sock;
+#endif
+    fds[0].events = ZSOCK_POLLIN;
+    // The CONNACK arrives through the normal input path
+    if (zsock_poll(fds, 1, 10000) <= 0) {
+        printf("No CONNACK from broker\n");
+        mqtt_abort(&client);
+        return -ETIMEDOUT;
+    }
+    mqtt_input(&client);
+    if (!atomic_get(&connected)) {
+        mqtt_abort(&client);
+        return -ECONNREFUSED;
+    }
+
+    ret = subscribe_all();
+    if (ret < 0) {
+        printf("Failed to subscribe, error: %d\n", ret);
+        mqtt_abort(&client);
+        atomic_set(&connected, 0);
+        return ret;
+    }
     return 0;
 }
 
-static int mqtt_publish_message(const char *topic, const char *message) {
-    struct mqtt_publish_param param;
-
-    param.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
-    param.message.topic.topic.utf8 = (uint8_t *)topic;
-    param.message.topic.topic.size = strlen(topic);
-    param.message.payload.data = (uint8_t *)message;
-    param.message.payload.len = strlen(message);
-    param.message_id = 1;
-    param.dup_flag = 0;
-    param.retain_flag = 0;
+/**
+ * Serve the connection until it drops. Sleeps in poll until the broker sends
+ * something, a message is queued, a PUBACK is overdue or the keepalive ping
+ * is due.
+ */
+static void mqtt_serve(void) {
+    int retry_ms = retry_inflight(true);
+
+    while (atomic_get(&connected)) {
+        if (flush_outbound() < 0) {
+            return;
+        }
 
-    printf("Publishing message to topic %s: %s\n", topic, message);
-    return mqtt_publish(&client, &param);
+        int timeout = mqtt_keepalive_time_left(&client);
+        if (retry_ms != SYS_FOREVER_MS && (timeout == SYS_FOREVER_MS || retry_ms < timeout)) {
+            timeout = retry_ms;
+        }
+        if (zsock_poll(fds, ARRAY_SIZE(fds), timeout) < 0) {
+            printf("Error in poll: %d\n", errno);
+            return;
+        }
+        if (fds[0].revents & ZSOCK_POLLIN) {
+            int ret = mqtt_input(&client);
+            if (ret != 0) {
+                printf("MQTT input failed: %d\n", ret);
+                return;
+            }
+        }
+        if (fds[0].revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP)) {
+            return;
+        }
+        mqtt_live(&client);
+        retry_ms = retry_inflight(false);
+    }
 }
 
-static int mqtt_subscribe_topic(const char* topic) {
-    struct mqtt_topic topics[1];
-    struct mqtt_subscription_list subscription;
-    topics[0].topic.utf8 = (uint8_t *)topic;
-    topics[0].topic.size = strlen(topic);
-    topics[0].qos = MQTT_QOS_1_AT_LEAST_ONCE;
-
-    subscription.list = topics;
-    subscription.list_count = 1;
-    subscription.message_id = 1;
-    printf("Subscribing to topic: %s\n", topic);
-    return mqtt_subscribe(&client, &subscription);
+/**
+ * Subscribe to a topic, with cb called for each message on it. Topics are
+ * matched exactly, wildcards are not supported. Only valid before
+ * zg_mqtt_start(), the subscriptions are renewed on every reconnect.
+ */
+int zg_mqtt_subscribe(const char *topic, enum mqtt_qos qos, zg_mqtt_rx_cb_t cb, void *user_data) {
+    if (atomic_get(&started)) {
+        return -EBUSY;
+    }
+    if (qos > MQTT_QOS_1_AT_LEAST_ONCE) {
+        return -ENOTSUP;
+    }
+    if (subscription_count == ARRAY_SIZE(subscriptions)) {
+        return -ENOMEM;
+    }
+    subscriptions[subscription_count++] = (struct subscription){
+        .topic = topic,
+        .qos = qos,
+        .cb = cb,
+        .user_data = user_data,
+    };
+    return 0;
+}
 
+/**
+ * Let the MQTT thread connect. Held back so an application can register its
+ * subscriptions, and finish any setup they depend on, first.
+ */
+void zg_mqtt_start(void) {
+    if (atomic_set(&started, 1) == 0) {
+        k_sem_give(&start_sem);
+    }
 }
 
-void mqtt_thread(void* arg) {
-    printf("Initialising MQTT Thread\n");
-    char mqtt_message[32];
-    //tls_credential_delete(HIVEMQ_CERTIFICATE_TAG, TLS_CREDENTIAL_CA_CERTIFICATE);
-    int ret;
-    ret = tls_credential_add(HIVEMQ_CERTIFICATE_TAG, TLS_CREDENTIAL_CA_CERTIFICATE, hive_cert, strlen(hive_cert) + 1);
-    if (ret != 0) {
-		printf("Failed to add credentials\n");
-	}
-    //init_rtc();
-    ret = connect_wifi();
-    if (ret < 0) {
-        printk("Failed to connect to WiFi network, error: %d\n", ret);
-        return;
+/**
+ * Queue a message for the MQTT thread. QoS 0 messages are refused while
+ * disconnected, as they would be stale by the time they went out; QoS 1
+ * messages wait for the connection and are resent until acknowledged.
+ */
+int zg_mqtt_publish(const char *topic, const void *payload, size_t len, enum mqtt_qos qos) {
+    struct outbound msg;
+
+    if (qos > MQTT_QOS_1_AT_LEAST_ONCE) {
+        return -ENOTSUP;
     }
-    
-    ret = broker_connect();
-    if (ret < 0) {
-        printk("Failed to initialize and connect to MQTT broker, error: %d\n", ret);
-        return;
+    if (len > sizeof(msg.payload)) {
+        return -EMSGSIZE;
+    }
+    if (qos == MQTT_QOS_0_AT_MOST_ONCE && !atomic_get(&connected)) {
+        return -ENOTCONN;
     }
-    
-    
-    if (client.transport.type == MQTT_TRANSPORT_SECURE) {
-		fds[0].fd = client.transport.tls.sock;
-	}
-    fds[0].events = ZSOCK_POLLIN;
-    nfds = 1;
 
-    ret = mqtt_subscribe_topic(MQTT_SUBSCRIBE_TOPIC);
-    if (ret < 0) {
-        printf("Failed to subscribe to topic, error: %d\n", ret);
-        return;
+    msg.topic = topic;
+    msg.len = len;
+    msg.qos = qos;
+    memcpy(msg.payload, payload, len);
+    if (k_msgq_put(&outbound_msgq, &msg, K_NO_WAIT) != 0) {
+        return -ENOMEM;
+    }
+    if (wake_fd >= 0) {
+        eventfd_write(wake_fd, 1);
     }
+    return 0;
+}
 
-    while(1) {
-        /* Publish message */
-        snprintf(mqtt_message, sizeof(mqtt_message), "Hello from ESP32C3 at %d", k_uptime_get_32());
-        ret = mqtt_publish_message(MQTT_PUBLISH_TOPIC, mqtt_message);
-        if (ret < 0) {
-            printk("Failed to publish message, error: %d\n", ret);
-        }
+bool zg_mqtt_connected(void) {
+    return atomic_get(&connected);
+}
 
-        /* Handle incoming MQTT events - received messages, etc. */
-        if (poll(fds, nfds, 10000) < 0) {
-            printf("Error in poll: %d\n", errno);
-            break;
-        }
+static void mqtt_thread(void *p1, void *p2, void *p3) {
+    k_sem_take(&start_sem, K_FOREVER);
 
-        if (fds[0].revents & POLLIN) {
-            ret = mqtt_input(&client);
-            if (ret != 0) {
-                printf("Error in mqtt_input: %d\n", ret);
-                break;
-            }
-        }
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        printf("Failed to create eventfd: %d\n", errno);
+        return;
+    }
+    fds[1].fd = wake_fd;
+    fds[1].events = ZSOCK_POLLIN;
+
+#ifdef CONFIG_ZG_MQTT_TLS_ISRG_ROOT
+    int ret = tls_credential_add(CONFIG_ZG_MQTT_TLS_SEC_TAG, TLS_CREDENTIAL_CA_CERTIFICATE,
+                                 isrg_root_x1, sizeof(isrg_root_x1));
+    if (ret != 0 && ret != -EEXIST) {
+        printf("Failed to add credentials: %d\n", ret);
+    }
+#endif
 
-        if (fds[0].revents & POLLERR) {
-            printk("POLLERR\n");
-            break;
+#ifdef CONFIG_WIFI
+    if (connect_wifi() < 0) {
+        return;
+    }
+#endif
+
+    while (1) {
+        if (broker_connect() == 0) {
+            mqtt_serve();
+            printf("MQTT connection lost, reconnecting\n");
+            atomic_set(&connected, 0);
+            mqtt_abort(&client);
         }
-
-        if (fds[0].revents & POLLHUP) {
-            printk("POLLHUP\n");
-            break;
-        }    
-        
-        k_msleep(10000);
+        k_msleep(CONFIG_ZG_MQTT_RECONNECT_DELAY_MS);
     }
 }
 
-
-K_THREAD_DEFINE(mqtt_id, MQTT_THREAD_STACK_SIZE, mqtt_thread, NULL, NULL, NULL, MQTT_PRIORITY, 0, 0);
\ No newline at end of file
+K_THREAD_DEFINE(zg_mqtt_id, CONFIG_ZG_MQTT_THREAD_STACK_SIZE, mqtt_thread, NULL, NULL, NULL,
+                CONFIG_ZG_MQTT_THREAD_PRIORITY, 0, 0);
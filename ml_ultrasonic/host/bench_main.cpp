@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "main_functions.h"
+#include "replay.h"
+
+/* Replays the training CSV through setup()/loop() and reports inference
+ * latency, tensor arena use and how often aligned windows match their
+ * label.
+ *
+ * Untested: not yet linked against TFLM or run, see CMakeLists.txt.
+ *
+ * Usage: ul_bench [csv] [passes]
+ */
+
+namespace {
+	double percentile(const std::vector<double> &sorted, double pct)
+	{
+		size_t index = static_cast<size_t>(pct / 100.0 * (sorted.size() - 1) + 0.5);
+		return sorted[index];
+	}
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	const char *csv_path = argc > 1 ? argv[1] : UL_DEFAULT_CSV;
+	int passes = argc > 2 ? atoi(argv[2]) : 1;
+
+	if (replay_load(csv_path, std::max(passes, 1)) != 0) {
+		return 1;
+	}
+
+	setup();
+	if (model_arena_used_bytes() == 0) {
+		fprintf(stderr, "setup() failed\n");
+		return 1;
+	}
+
+	std::vector<double> latencies;
+	const struct replay_stats *stats = replay_get_stats();
+	while (replay_remaining() > 0) {
+		unsigned int before = stats->inferences;
+		auto start = std::chrono::steady_clock::now();
+		loop();
+		auto end = std::chrono::steady_clock::now();
+		if (stats->inferences != before) {
+			latencies.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+		}
+	}
+
+	if (latencies.empty()) {
+		fprintf(stderr, "No inferences ran\n");
+		return 1;
+	}
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("inferences:      %u (hop %d)\n", stats->inferences, UL_HOP_SIZE);
+	printf("latency us:      p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+	       percentile(latencies, 50), percentile(latencies, 90),
+	       percentile(latencies, 99), latencies.back());
+	printf("arena used:      %zu bytes (%zu-bit host, not the board's)\n",
+	       model_arena_used_bytes(), 8 * sizeof(void *));
+	printf("categories:      lower %u  higher %u  none %u\n",
+	       stats->categories[1], stats->categories[2], stats->categories[3]);
+	if (stats->aligned > 0) {
+		printf("agreement:       %u/%u aligned windows (%.1f%%)\n",
+		       stats->agreed, stats->aligned, 100.0 * stats->agreed / stats->aligned);
+	}
+	return 0;
+}
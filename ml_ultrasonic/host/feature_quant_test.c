@@ -0,0 +1,114 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "feature_quant.h"
+#include "ultrasonic_handler.h"
+
+/* Checks the fixed-point feature stage against the float path it
+ * replaced, clamp(round(metres / scale) + zero_point) over randomised echo
+ * triples, at the bundled model's input quantization and a spread of
+ * others. Every output must be within one LSB.
+ */
+
+#define TRIPLES 200000
+
+struct input_params {
+    float scale;
+    int32_t zero_point;
+};
+
+static const struct input_params params[] = {
+    { 0.022823527455329895f, 124 },     /* ul_model_data.cpp */
+    { 0.0117647f, 0 },
+    { 0.0117647f, 255 },
+    { 0.05f, 128 },
+    { 0.004f, 40 },          /* About the finest scale accepted */
+};
+
+static float echo_us_to_metres(int32_t us) {
+    return fminf((us / 1000000.0f) * 343.0f / 2.0f, ULTRASONIC_MAX_RANGE_M);
+}
+
+static int float_quantize(const struct input_params *p, float metres) {
+    long q = lroundf(metres / p->scale) + p->zero_point;
+    return q < 0 ? 0 : q > 255 ? 255 : (int)q;
+}
+
+static int32_t random_echo_us(void) {
+    // Some samples past the sensor range, which both paths clamp
+    return rand() % (FEATURE_MAX_ECHO_US + 2000);
+}
+
+static int check(const struct input_params *p, int *max_diff, long *exact) {
+    struct feature_quant quant;
+
+    if (feature_quant_init(&quant, p->scale, p->zero_point) != 0) {
+        printf("scale %f rejected\n", p->scale);
+        return 1;
+    }
+
+    for (int i = 0; i < TRIPLES; i++) {
+        int32_t us[3];
+        float metres[3];
+        for (int j = 0; j < 3; j++) {
+            us[j] = random_echo_us();
+            if (us[j] > FEATURE_MAX_ECHO_US) {
+                us[j] = FEATURE_MAX_ECHO_US;
+            }
+            metres[j] = echo_us_to_metres(us[j]);
+        }
+
+        int32_t fixed_in[3] = {
+            us[2],
+            us[2] - us[1],
+            (us[2] - us[1]) - (us[1] - us[0]),
+        };
+        float float_in[3] = {
+            metres[2],
+            metres[2] - metres[1],
+            (metres[2] - metres[1]) - (metres[1] - metres[0]),
+        };
+
+        for (int j = 0; j < 3; j++) {
+            int fixed = feature_quantize(&quant, fixed_in[j]);
+            int reference = float_quantize(p, float_in[j]);
+            int diff = abs(fixed - reference);
+            if (diff > 1) {
+                printf("scale %f zp %d: %d us gives %d, float path %d\n",
+                       p->scale, (int)p->zero_point, (int)fixed_in[j], fixed, reference);
+                return 1;
+            }
+            if (diff > *max_diff) {
+                *max_diff = diff;
+            }
+            *exact += diff == 0;
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    struct feature_quant quant;
+    int failed = 0;
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+        int max_diff = 0;
+        long exact = 0;
+
+        if (check(&params[i], &max_diff, &exact) != 0) {
+            failed = 1;
+            continue;
+        }
+        printf("scale %f zp %3d: max diff %d, %.2f%% identical\n",
+               params[i].scale, (int)params[i].zero_point, max_diff,
+               100.0 * exact / (3.0 * TRIPLES));
+    }
+
+    // Scales too fine for 32-bit products must be refused
+    if (feature_quant_init(&quant, 0.0001f, 0) == 0) {
+        printf("scale 0.0001 accepted\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,131 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "gesture_classifier.h"
+#include "ul_model_data.h"
+
+/* Checks the gesture thresholds against the bundled model: its output
+ * must be quantized the way the thresholds assume, and outputs in that
+ * domain must be decided and voted on as documented.
+ */
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* Just enough flatbuffer to find the model's output tensor */
+static uint32_t read_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static const uint8_t *table_field(const uint8_t *table, int index) {
+    const uint8_t *vtable = table - (int32_t)read_u32(table);
+    uint16_t vtable_len = vtable[0] | vtable[1] << 8;
+    if (4 + 2 * index >= vtable_len) {
+        return NULL;
+    }
+    uint16_t offset = vtable[4 + 2 * index] | vtable[5 + 2 * index] << 8;
+    return offset ? table + offset : NULL;
+}
+
+static const uint8_t *vector(const uint8_t *field, uint32_t *count) {
+    const uint8_t *vec = field + read_u32(field);
+    *count = read_u32(vec);
+    return vec + 4;
+}
+
+static const uint8_t *vector_table(const uint8_t *field, uint32_t index) {
+    uint32_t count;
+    const uint8_t *elems = vector(field, &count);
+    return elems + 4 * index + read_u32(elems + 4 * index);
+}
+
+static void check_model_output(void) {
+    const uint8_t *model = model_tflite;
+    uint32_t count;
+
+    CHECK(memcmp(model + 4, "TFL3", 4) == 0);
+    const uint8_t *root = model + read_u32(model);
+    // Model.subgraphs, SubGraph.outputs and SubGraph.tensors
+    const uint8_t *subgraph = vector_table(table_field(root, 2), 0);
+    const uint8_t *outputs = vector(table_field(subgraph, 2), &count);
+    const uint8_t *tensor = vector_table(table_field(subgraph, 0), read_u32(outputs));
+
+    // Tensor.type, TensorType UINT8 is 3
+    const uint8_t *type = table_field(tensor, 1);
+    CHECK(type != NULL && *type == 3);
+
+    // Tensor.shape, one output per category at least
+    const uint8_t *shape = vector(table_field(tensor, 0), &count);
+    CHECK(count > 0 && read_u32(shape + 4 * (count - 1)) >= GESTURE_CLASSES);
+
+    // Tensor.quantization, QuantizationParameters.scale and zero_point
+    const uint8_t *quant = table_field(tensor, 4);
+    CHECK(quant != NULL);
+    quant += read_u32(quant);
+    const uint8_t *scale = vector(table_field(quant, 2), &count);
+    float scale_value;
+    memcpy(&scale_value, scale, sizeof(scale_value));
+    CHECK(count == 1 && scale_value == GESTURE_OUTPUT_SCALE);
+    const uint8_t *zero_point = vector(table_field(quant, 3), &count);
+    CHECK(count == 1 && read_u32(zero_point) == GESTURE_OUTPUT_ZERO_POINT &&
+          read_u32(zero_point + 4) == 0);
+}
+
+static uint8_t probability(float p) {
+    return (uint8_t)(p / GESTURE_OUTPUT_SCALE + 0.5f);
+}
+
+static void check_classify(void) {
+    uint8_t output[4] = { 0 };
+
+    gesture_classifier_init(NULL);
+
+    // A confident "none" is above 127, which int8 would have read as negative
+    output[GESTURE_NONE - 1] = probability(0.9f);
+    output[GESTURE_HIGHER - 1] = probability(0.05f);
+    output[GESTURE_LOWER - 1] = probability(0.05f);
+    CHECK(gesture_classify(output) == GESTURE_NONE);
+
+    // Thresholds are strict, exactly at the threshold does not win
+    output[GESTURE_NONE - 1] = UL_GESTURE_NONE_THRESHOLD;
+    output[GESTURE_HIGHER - 1] = probability(0.3f);
+    CHECK(gesture_classify(output) == GESTURE_LOWER);
+
+    output[GESTURE_NONE - 1] = probability(0.1f);
+    output[GESTURE_HIGHER - 1] = probability(0.85f);
+    output[GESTURE_LOWER - 1] = probability(0.05f);
+    CHECK(gesture_classify(output) == GESTURE_HIGHER);
+
+    output[GESTURE_HIGHER - 1] = probability(0.1f);
+    output[GESTURE_LOWER - 1] = probability(0.8f);
+    CHECK(gesture_classify(output) == GESTURE_LOWER);
+}
+
+static void check_vote(void) {
+    const uint8_t higher[4] = { probability(0.1f), probability(0.8f), probability(0.1f), 0 };
+    const uint8_t none[4] = { probability(0.1f), probability(0.1f), probability(0.8f), 0 };
+
+    gesture_classifier_init(NULL);
+
+    // Two of the last three win, then the window starts again
+    CHECK(gesture_classifier_update(higher) == GESTURE_NONE);
+    CHECK(gesture_classifier_update(none) == GESTURE_NONE);
+    CHECK(gesture_classifier_update(higher) == GESTURE_HIGHER);
+    CHECK(gesture_classifier_update(higher) == GESTURE_NONE);
+}
+
+int main(void) {
+    check_model_output();
+    check_classify();
+    check_vote();
+    if (failures == 0) {
+        printf("gesture classifier ok\n");
+    }
+    return failures != 0;
+}
@@ -0,0 +1,22 @@
+#ifndef UL_REPLAY_H_
+#define UL_REPLAY_H_
+
+#include <stddef.h>
+
+/* Host-only side of the replay ultrasonic_handler. Rows of the training
+ * CSV are fed to the pipeline back to back, one distance per
+ * ultrasonic_get_sample() call.
+ */
+
+struct replay_stats {
+    unsigned int inferences;
+    unsigned int aligned;       /* Inferences whose window is exactly one CSV row */
+    unsigned int agreed;        /* ... of which matched the row's label */
+    unsigned int categories[4]; /* Published count per category, index 1..3 */
+};
+
+int replay_load(const char *path, int passes);
+size_t replay_remaining(void);
+const struct replay_stats *replay_get_stats(void);
+
+#endif
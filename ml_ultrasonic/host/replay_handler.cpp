@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ultrasonic_handler.h"
+#include "replay.h"
+
+/* Stands in for ultrasonic_handler.c on the host. Distances come from the
+ * training CSV, converted back into the echo durations the sensor would
+ * have reported.
+ */
+
+namespace {
+	constexpr int kRowLength = 30;
+	constexpr float kMetresPerEchoUs = 343.0f / 2.0f / 1000000.0f;
+
+	std::vector<float> distances;
+	std::vector<int> labels;
+	size_t next_sample;
+	struct replay_stats stats;
+} /* namespace */
+
+int replay_load(const char *path, int passes)
+{
+	FILE *csv = fopen(path, "r");
+	if (!csv) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		return -1;
+	}
+
+	std::vector<float> row_distances;
+	std::vector<int> row_labels;
+	char line[1024];
+	// Skip the dist_0..dist_29,label header
+	if (!fgets(line, sizeof(line), csv)) {
+		fclose(csv);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), csv)) {
+		char *cursor = line;
+		float row[kRowLength];
+		int i;
+		for (i = 0; i < kRowLength; i++) {
+			char *end;
+			row[i] = strtof(cursor, &end);
+			if (end == cursor || *end != ',') {
+				break;
+			}
+			cursor = end + 1;
+		}
+		if (i != kRowLength) {
+			continue;
+		}
+		row_distances.insert(row_distances.end(), row, row + kRowLength);
+		row_labels.push_back(atoi(cursor));
+	}
+	fclose(csv);
+
+	if (row_labels.empty()) {
+		fprintf(stderr, "No rows in %s\n", path);
+		return -1;
+	}
+	for (int pass = 0; pass < passes; pass++) {
+		distances.insert(distances.end(), row_distances.begin(), row_distances.end());
+		labels.insert(labels.end(), row_labels.begin(), row_labels.end());
+	}
+	next_sample = 0;
+	memset(&stats, 0, sizeof(stats));
+	return 0;
+}
+
+size_t replay_remaining(void)
+{
+	return distances.size() - next_sample;
+}
+
+const struct replay_stats *replay_get_stats(void)
+{
+	return &stats;
+}
+
+void ultrasonic_init(void)
+{
+}
+
+void ultrasonic_get_sample(struct ultrasonic_sample *sample)
+{
+	float dist = ULTRASONIC_MAX_RANGE_M;
+	if (next_sample < distances.size()) {
+		dist = distances[next_sample++];
+	}
+
+	sample->timestamp = next_sample * 50;
+	// The collector logged missed echoes as the 3 m ceiling
+	sample->valid = dist < ULTRASONIC_MAX_RANGE_M;
+	sample->duration = sample->valid ? static_cast<uint32_t>(dist / kMetresPerEchoUs + 0.5f) : 0;
+}
+
+float ultrasonic_read(void)
+{
+	struct ultrasonic_sample sample;
+
+	ultrasonic_get_sample(&sample);
+	if (!sample.valid) {
+		return ULTRASONIC_MAX_RANGE_M;
+	}
+	return sample.duration * kMetresPerEchoUs;
+}
+
+void ultrasonic_publish(int category)
+{
+	stats.inferences++;
+	if (category >= 1 && category <= 3) {
+		stats.categories[category]++;
+	}
+	// Windows that end on a row boundary cover exactly one labelled row
+	if (next_sample % kRowLength == 0) {
+		stats.aligned++;
+		if (labels[next_sample / kRowLength - 1] == category) {
+			stats.agreed++;
+		}
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef FEATURE_QUANT_H_
+#define FEATURE_QUANT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* Features are worked out in echo microseconds, which are exact
+     * integers, and only scaled into the model's uint8 input domain by a
+     * single fixed-point multiply. With the speed of sound fixed, one echo
+     * microsecond is 171.5 um of distance, so round(metres / scale) becomes
+     * round(us * (FEATURE_METRES_PER_ECHO_US / scale)) and that reciprocal
+     * is worked out once the model's input scale is known.
+     */
+    #define FEATURE_METRES_PER_ECHO_US (343.0f / 2.0f / 1000000.0f)
+    /* ULTRASONIC_MAX_RANGE_M in echo microseconds */
+    #define FEATURE_MAX_ECHO_US 17493
+    /* Acceleration is the largest feature, at most two full-range swings */
+    #define FEATURE_MAX_VALUE_US (2 * FEATURE_MAX_ECHO_US)
+    #define FEATURE_QUANT_SHIFT 20
+
+    struct feature_quant {
+        int32_t multiplier;     /* FEATURE_METRES_PER_ECHO_US / scale in Q20 */
+        int32_t zero_point;
+    };
+
+    int feature_quant_init(struct feature_quant *quant, float scale, int32_t zero_point);
+    uint8_t feature_quantize(const struct feature_quant *quant, int32_t value_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
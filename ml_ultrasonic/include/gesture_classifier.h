@@ -0,0 +1,61 @@
+#ifndef GESTURE_CLASSIFIER_H_
+#define GESTURE_CLASSIFIER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* Categories as trained in tflm_training, output index + 1 */
+    #define GESTURE_LOWER 1         /* Swipe down towards the sensor */
+    #define GESTURE_HIGHER 2        /* Swipe up away from the sensor */
+    #define GESTURE_NONE 3          /* Swipe across, or nothing */
+    #define GESTURE_CLASSES 3
+
+    /* Raw decisions the vote is taken over, at most 32 */
+    #ifndef UL_GESTURE_VOTE_WINDOW
+    #define UL_GESTURE_VOTE_WINDOW 3
+    #endif
+    /* Votes a volume gesture needs within the window to be reported */
+    #ifndef UL_GESTURE_VOTE_MIN
+    #define UL_GESTURE_VOTE_MIN 2
+    #endif
+
+    /* Thresholds on the raw softmax outputs. The model's output is uint8
+     * with scale 1/256 and zero point 0, so a threshold q stands for a
+     * probability of q / 256: the defaults are p > 0.51 for "none" and
+     * p > 0.48 for "higher". The earlier 2 and -6 were compared with the
+     * uint8 bytes read as int8, where any output of 128 or more, the
+     * confident ones, came out negative.
+     */
+    #ifndef UL_GESTURE_NONE_THRESHOLD
+    #define UL_GESTURE_NONE_THRESHOLD 130
+    #endif
+    #ifndef UL_GESTURE_HIGHER_THRESHOLD
+    #define UL_GESTURE_HIGHER_THRESHOLD 122
+    #endif
+    /* Output quantization the thresholds are given in */
+    #define GESTURE_OUTPUT_SCALE (1.0f / 256.0f)
+    #define GESTURE_OUTPUT_ZERO_POINT 0
+
+    struct gesture_config {
+        /* A class wins when its output is strictly above its threshold.
+         * Classes are tried none, higher, lower; lower is the fallback and
+         * its entry is unused.
+         */
+        uint8_t threshold[GESTURE_CLASSES];
+        uint8_t vote_window;
+        uint8_t vote_min;
+    };
+
+    void gesture_classifier_init(const struct gesture_config *config);
+    void gesture_classifier_reset(void);
+    int gesture_classify(const uint8_t *output);
+    int gesture_classifier_update(const uint8_t *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +1,16 @@
 #ifndef ULTRASONIC_MAIN_FUNCTIONS_H_
 #define ULTRASONIC_MAIN_FUNCTIONS_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
     void setup(void);
     void loop(void);
+    /* Tensor arena bytes in use, or 0 if setup() did not complete */
+    size_t model_arena_used_bytes(void);
 
 #ifdef __cplusplus
 }
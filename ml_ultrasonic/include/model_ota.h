@@ -0,0 +1,34 @@
+#ifndef MODEL_OTA_H_
+#define MODEL_OTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zg_mqtt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    #define MODEL_OTA_TOPIC "zephyrus/green/ultrasonic/model"
+
+    /* Largest image data carried by one MQTT message */
+    #define MODEL_OTA_CHUNK_SIZE 1024
+
+    /* Each message is this header followed by up to MODEL_OTA_CHUNK_SIZE
+     * bytes of the packed model image, all little endian. Chunks arrive in
+     * order and a chunk at offset 0 starts a new transfer. Chunks already
+     * written, which QoS 1 may deliver again, are ignored, as are those of
+     * the last image written, known by its header's CRC and sequence.
+     */
+    struct model_chunk_header {
+        uint32_t total;     /* Size of the whole image */
+        uint32_t offset;    /* Where this chunk's data goes in the image */
+    };
+
+    int model_ota_handle_chunk(struct zg_mqtt_message *msg, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
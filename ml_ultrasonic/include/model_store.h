@@ -0,0 +1,50 @@
+#ifndef MODEL_STORE_H_
+#define MODEL_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /* "ULMD", little endian */
+    #define MODEL_IMAGE_MAGIC 0x444d4c55
+    #define MODEL_IMAGE_VERSION 2
+
+    /* Update chunks must keep flash writes aligned to this, only the last
+     * chunk of an image may be shorter.
+     */
+    #define MODEL_WRITE_ALIGN 16
+
+    /* Written by scripts/pack_model.py in front of the .tflite bytes. Its
+     * 32 byte size keeps the flatbuffer aligned for TFLM.
+     */
+    struct model_image_header {
+        uint32_t magic;
+        uint16_t header_version;
+        uint16_t schema_version;    /* TFLite schema the model targets */
+        uint32_t length;            /* Model bytes following the header */
+        uint32_t crc32;             /* crc32_ieee() of those bytes */
+        uint32_t sequence;          /* Higher wins when both slots are valid */
+        uint32_t reserved[3];
+    };
+
+    const uint8_t *model_store_load(uint32_t schema_version, size_t *length);
+
+    /* Writing a new image into the inactive slot, from the network thread */
+    int model_store_update_begin(size_t image_size);
+    int model_store_update_write(size_t offset, const uint8_t *data, size_t len);
+    int model_store_update_finish(uint32_t schema_version);
+    void model_store_update_abort(void);
+
+    /* Picking the new image up, from the inference thread */
+    const uint8_t *model_store_take_pending(size_t *length);
+    void model_store_confirm(bool accepted);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
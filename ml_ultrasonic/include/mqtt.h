@@ -0,0 +1,27 @@
+#ifndef UL_MQTT_H_
+#define UL_MQTT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    #define GESTURE_TOPIC "zephyrus/green/ultrasonic/gesture"
+
+    /* Gesture event payload, 13 bytes little endian:
+     *   u32 seq        Increments per event, gaps mean lost events
+     *   u32 sample_ms  Uptime when the window's last sample was triggered
+     *   u32 sent_ms    Uptime when the event was queued for the broker
+     *   u8  category   1 lower, 2 higher
+     */
+    #define GESTURE_PAYLOAD_LEN 13
+
+    void mqtt_start(void);
+    void mqtt_publish_gesture(int category, uint32_t sample_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
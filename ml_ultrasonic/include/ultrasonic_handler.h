@@ -1,11 +1,24 @@
 #ifndef ML_ULTRASONIC
 #define ML_ULTRASONIC
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
-    
+
+    /* Furthest distance the sensor reports, also used for missed echoes */
+    #define ULTRASONIC_MAX_RANGE_M 3.0f
+
+    struct ultrasonic_sample {
+        uint32_t timestamp;     /* Uptime in ms when the trigger fired */
+        uint32_t duration;      /* Echo pulse width in us */
+        bool valid;             /* False if the echo timed out */
+    };
+
     void ultrasonic_init(void);           
+    void ultrasonic_get_sample(struct ultrasonic_sample *sample);
     float ultrasonic_read(void);
     void ultrasonic_publish(int category);
 
@@ -13,4 +26,4 @@ extern "C" {
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
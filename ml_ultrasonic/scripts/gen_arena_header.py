@@ -0,0 +1,256 @@
+"""
+Pin the TFLM tensor arena to a measured size.
+
+Reads the board's serial log from a -DUL_ARENA_PROFILE=ON build, finds the
+"arena_used_bytes=N" line printed by setup() and rewrites
+include/ul_arena_size.h with N plus a safety margin.
+
+    python scripts/gen_arena_header.py boot.log
+    python scripts/gen_arena_header.py --used 7424
+
+Arena use depends on pointer size and alignment, so only a 32-bit build
+measures what the board needs. Logs from a 64-bit build, such as ul_bench
+on a PC, overstate it and are refused unless --allow-host is given.
+
+Until a board log exists the header keeps the baseline's 20 KiB. --model
+prints an estimate for a 32-bit target from the model itself, as a guide
+only; it never writes the header. The activation buffers are planned the
+way TFLM's GreedyMemoryPlanner does it, but the persistent allocations
+are worked out from guessed struct sizes, and an arena sized from a low
+guess fails AllocateTensors() at boot.
+
+    python scripts/gen_arena_header.py --model src/ul_model_data.cpp
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+from gen_op_resolver import Table, load_model
+
+HEADER_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "..", "include", "ul_arena_size.h")
+
+# TFLM aligns tensor buffers to 16 bytes
+ALIGNMENT = 16
+
+PROFILE_SIZE = "(40 * 1024)"
+
+MEASURED_MARGIN = 10
+
+TEMPLATE = """#ifndef UL_ARENA_SIZE_H_
+#define UL_ARENA_SIZE_H_
+
+/* Generated by scripts/gen_arena_header.py, regenerate after retraining.
+ * {source}
+ */
+#define UL_ARENA_USED_BYTES {used}
+#define UL_TENSOR_ARENA_SIZE {size}
+
+/* Arena used while profiling, large enough for any model that fits in RAM */
+#define UL_ARENA_PROFILE_SIZE {profile}
+
+#endif
+"""
+
+
+def used_from_log(path):
+    """Last arena_used_bytes=N in the log, and the pointer size it was
+    measured with if the log says."""
+    pattern = re.compile(r"arena_used_bytes=(\d+)(?:.*\bptr=(\d+))?")
+    used = None
+    ptr = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            match = pattern.search(line)
+            if match:
+                # Keep the last boot in the log
+                used = int(match.group(1))
+                ptr = int(match.group(2)) if match.group(2) else None
+    return used, ptr
+
+
+# Bytes per element of each TensorType
+TYPE_SIZES = {0: 4, 1: 2, 2: 4, 3: 1, 4: 8, 6: 1, 7: 2, 9: 1, 10: 8, 16: 8}
+
+# Persistent allocations of a 32-bit TFLM build. The allocator, planner and
+# graph objects, then per tensor (TfLiteEvalTensor), per op
+# (NodeAndRegistration) and per subgraph input or output (TfLiteTensor with
+# its quantization).
+FIXED_BYTES = 256
+EVAL_TENSOR_BYTES = 12
+NODE_BYTES = 32
+IO_TENSOR_BYTES = 96
+# Builtin params plus kernel OpData for the reference kernels, by builtin
+# code. Ops with per-channel quantization also keep a multiplier and a shift
+# per output channel.
+OP_BYTES = {
+    3: 28 + 64,     # CONV_2D
+    4: 28 + 64,     # DEPTHWISE_CONV_2D
+    6: 24,          # DEQUANTIZE
+    9: 8 + 40,      # FULLY_CONNECTED
+    22: 36,         # RESHAPE
+    25: 4 + 64,     # SOFTMAX
+    70: 0,          # EXPAND_DIMS
+    114: 24,        # QUANTIZE
+}
+UNKNOWN_OP_BYTES = 64
+
+
+def int_vector(table, index):
+    pos = table.field(index)
+    if pos is None:
+        return []
+    vec = pos + struct.unpack_from("<I", table.buf, pos)[0]
+    count = struct.unpack_from("<I", table.buf, vec)[0]
+    return list(struct.unpack_from(f"<{count}i", table.buf, vec + 4))
+
+
+def vector_length(table, index):
+    pos = table.field(index)
+    if pos is None:
+        return 0
+    return struct.unpack_from("<I", table.buf, pos + struct.unpack_from("<I", table.buf, pos)[0])[0]
+
+
+def align(size):
+    return (size + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def plan_greedy(buffers):
+    """Offsets as GreedyMemoryPlanner lays out (size, first, last) buffers:
+    largest first, each at the lowest offset clear of every buffer alive at
+    the same time. Returns the planned size."""
+    order = sorted(range(len(buffers)), key=lambda i: -buffers[i][0])
+    placed = []
+    for i in order:
+        size, first, last = buffers[i]
+        offset = 0
+        for other_offset, other_size, other_first, other_last in sorted(placed):
+            if other_last < first or other_first > last:
+                continue
+            if offset + size <= other_offset:
+                break
+            offset = max(offset, other_offset + other_size)
+        placed.append((offset, size, first, last))
+    return max((offset + size for offset, size, _, _ in placed), default=0)
+
+
+def estimate_from_model(model):
+    """Estimated arena_used_bytes of a 32-bit build, as (total, planned
+    activation bytes)."""
+    if model[4:8] != b"TFL3":
+        sys.exit("Not a TFLite flatbuffer")
+    root = Table(model, struct.unpack_from("<I", model, 0)[0])
+    codes = [max(c.scalar(0, "<b", 0), c.scalar(3, "<i", 0)) for c in root.tables(1)]
+    buffers = root.tables(4)
+    subgraphs = root.tables(2)
+    if len(subgraphs) != 1:
+        sys.exit("Only single subgraph models can be estimated")
+    subgraph = subgraphs[0]
+    tensors = subgraph.tables(0)
+    inputs = int_vector(subgraph, 1)
+    outputs = int_vector(subgraph, 2)
+    operators = subgraph.tables(3)
+
+    def is_constant(tensor):
+        buffer = buffers[tensor.scalar(2, "<I", 0)]
+        # Buffer.data, or offset past the flatbuffer for large models
+        return vector_length(buffer, 0) > 0 or buffer.scalar(1, "<Q", 0) > 1
+
+    # Lifetimes as AllocationInfoBuilder marks them
+    first = {i: 0 for i in inputs}
+    last = {}
+    for index, op in enumerate(operators):
+        for t in int_vector(op, 1):
+            if t >= 0:
+                last[t] = index
+        for t in int_vector(op, 2):
+            first.setdefault(t, index)
+    for t in outputs:
+        last[t] = len(operators) - 1
+
+    planned = []
+    for index, tensor in enumerate(tensors):
+        if is_constant(tensor) or index not in first:
+            continue
+        elements = 1
+        for dim in int_vector(tensor, 0):
+            elements *= dim
+        size = elements * TYPE_SIZES.get(tensor.scalar(1, "<b", 0), 4)
+        planned.append((align(size), first[index], last.get(index, first[index])))
+    activations = plan_greedy(planned)
+
+    persistent = FIXED_BYTES
+    persistent += len(tensors) * EVAL_TENSOR_BYTES
+    persistent += len(operators) * NODE_BYTES
+    persistent += (len(inputs) + len(outputs)) * IO_TENSOR_BYTES
+    for op in operators:
+        code = codes[op.scalar(0, "<I", 0)]
+        persistent += OP_BYTES.get(code, UNKNOWN_OP_BYTES)
+        op_inputs = int_vector(op, 1)
+        if code in (3, 4, 9) and len(op_inputs) > 1:
+            weights = tensors[op_inputs[1]]
+            quantization = weights.field(4)
+            channels = int_vector(weights, 0)[0 if code != 4 else -1]
+            if code != 9 or (quantization is not None and
+                             vector_length(Table(model, quantization + struct.unpack_from("<I", model, quantization)[0]), 2) > 1):
+                persistent += align(8 * channels)
+    return persistent + activations, activations
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="board log containing arena_used_bytes=N")
+    parser.add_argument("--used", type=int, help="arena bytes measured on the board, instead of a log")
+    parser.add_argument("--model", help="print an estimate from a .tflite file or ul_model_data.cpp, "
+                                        "without writing the header")
+    parser.add_argument("--allow-host", action="store_true",
+                        help="accept a log from a 64-bit build, which overstates the board's use")
+    parser.add_argument("--margin", type=int,
+                        help=f"percent added on top (default {MEASURED_MARGIN})")
+    parser.add_argument("--output", default=HEADER_PATH)
+    args = parser.parse_args()
+
+    if args.model:
+        used, activations = estimate_from_model(load_model(args.model))
+        print(f"Estimated {used} bytes for a 32-bit target, {activations} of them planned "
+              "activations. Not written: pin the arena from a board log.")
+        return
+
+    used = args.used
+    source = "Measured {used} bytes on the board, plus a {margin}% margin."
+    margin = MEASURED_MARGIN
+    if used is None:
+        if not args.log:
+            parser.error("give a log file, --used or --model")
+        used, ptr = used_from_log(args.log)
+        if used is None:
+            sys.exit(f"No arena_used_bytes line in {args.log}")
+        if ptr is None:
+            print("warning: the log does not say its pointer size, make sure it "
+                  "came from the board", file=sys.stderr)
+        elif ptr != 4:
+            if not args.allow_host:
+                sys.exit(f"{args.log} is from a {8 * ptr}-bit build, its arena use does not "
+                         "apply to the board (--allow-host to use it anyway)")
+            print(f"warning: pinning to a {8 * ptr}-bit host measurement, the board "
+                  "needs less", file=sys.stderr)
+            source = (f"Measured {{used}} bytes on a {8 * ptr}-bit host, not the board, plus a\n"
+                      " * {margin}% margin. The board needs less.")
+    if args.margin is not None:
+        margin = args.margin
+
+    size = used * (100 + margin) // 100
+    size = align(size)
+
+    with open(args.output, "w") as f:
+        f.write(TEMPLATE.format(source=source.format(used=used, margin=margin),
+                                used=used, size=size, profile=PROFILE_SIZE))
+    print(f"Arena pinned to {size} bytes ({used} used)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,222 @@
+"""
+Generate the TFLM op resolver for exactly the ops a model uses.
+
+Reads the operator_codes table of a .tflite flatbuffer, either directly or
+from the C array in src/ul_model_data.cpp, and writes a header declaring a
+MicroMutableOpResolver sized for those ops. A model using an op this table
+does not know fails here, at build time, rather than in AllocateTensors().
+
+    python scripts/gen_op_resolver.py src/ul_model_data.cpp build/ul_op_resolver.h
+    python scripts/gen_op_resolver.py model_3.tflite build/ul_op_resolver.h
+"""
+import argparse
+import os
+import re
+import struct
+import sys
+
+# BuiltinOperator code -> MicroMutableOpResolver method
+OP_TABLE = {
+    0: "AddAdd",
+    1: "AddAveragePool2D",
+    2: "AddConcatenation",
+    3: "AddConv2D",
+    4: "AddDepthwiseConv2D",
+    5: "AddDepthToSpace",
+    6: "AddDequantize",
+    8: "AddFloor",
+    9: "AddFullyConnected",
+    11: "AddL2Normalization",
+    12: "AddL2Pool2D",
+    14: "AddLogistic",
+    17: "AddMaxPool2D",
+    18: "AddMul",
+    19: "AddRelu",
+    21: "AddRelu6",
+    22: "AddReshape",
+    23: "AddResizeBilinear",
+    25: "AddSoftmax",
+    26: "AddSpaceToDepth",
+    27: "AddSvdf",
+    28: "AddTanh",
+    34: "AddPad",
+    36: "AddGather",
+    37: "AddBatchToSpaceNd",
+    38: "AddSpaceToBatchNd",
+    39: "AddTranspose",
+    40: "AddMean",
+    41: "AddSub",
+    42: "AddDiv",
+    43: "AddSqueeze",
+    44: "AddUnidirectionalSequenceLSTM",
+    45: "AddStridedSlice",
+    47: "AddExp",
+    49: "AddSplit",
+    50: "AddLogSoftmax",
+    53: "AddCast",
+    54: "AddPrelu",
+    55: "AddMaximum",
+    56: "AddArgMax",
+    57: "AddMinimum",
+    58: "AddLess",
+    59: "AddNeg",
+    60: "AddPadV2",
+    61: "AddGreater",
+    62: "AddGreaterEqual",
+    63: "AddLessEqual",
+    65: "AddSlice",
+    66: "AddSin",
+    67: "AddTransposeConv",
+    70: "AddExpandDims",
+    71: "AddEqual",
+    72: "AddNotEqual",
+    73: "AddLog",
+    74: "AddSum",
+    75: "AddSqrt",
+    76: "AddRsqrt",
+    77: "AddShape",
+    79: "AddArgMin",
+    82: "AddReduceMax",
+    83: "AddPack",
+    84: "AddLogicalOr",
+    86: "AddLogicalAnd",
+    87: "AddLogicalNot",
+    88: "AddUnpack",
+    90: "AddFloorDiv",
+    92: "AddSquare",
+    93: "AddZerosLike",
+    94: "AddFill",
+    95: "AddFloorMod",
+    97: "AddResizeNearestNeighbor",
+    98: "AddLeakyRelu",
+    99: "AddSquaredDifference",
+    100: "AddMirrorPad",
+    101: "AddAbs",
+    102: "AddSplitV",
+    104: "AddCeil",
+    106: "AddAddN",
+    107: "AddGatherNd",
+    108: "AddCos",
+    111: "AddElu",
+    114: "AddQuantize",
+    116: "AddRound",
+    117: "AddHardSwish",
+}
+
+BUILTIN_CUSTOM = 32
+
+TEMPLATE = """/* Generated by scripts/gen_op_resolver.py from {source}, do not edit. */
+#ifndef UL_OP_RESOLVER_H_
+#define UL_OP_RESOLVER_H_
+
+#include <tensorflow/lite/micro/micro_mutable_op_resolver.h>
+
+using UlOpResolver = tflite::MicroMutableOpResolver<{count}>;
+
+static inline TfLiteStatus ul_register_ops(UlOpResolver &resolver)
+{{
+{calls}
+	return kTfLiteOk;
+}}
+
+#endif
+"""
+
+CALL = """	if (resolver.{method}() != kTfLiteOk) {{
+		return kTfLiteError;
+	}}"""
+
+
+def load_model(path):
+    if path.endswith(".tflite"):
+        with open(path, "rb") as f:
+            return f.read()
+    # C array as written by xxd -i / tensor_generator.py
+    with open(path) as f:
+        text = f.read()
+    start = text.index("{", text.index("model_tflite[]"))
+    end = text.index("};", start)
+    return bytes(int(b, 16) for b in re.findall(r"0x([0-9a-fA-F]{2})", text[start:end]))
+
+
+class Table:
+    """Just enough flatbuffer to walk a table's fields."""
+
+    def __init__(self, buf, pos):
+        self.buf = buf
+        self.pos = pos
+        self.vtable = pos - struct.unpack_from("<i", buf, pos)[0]
+        self.vtable_len = struct.unpack_from("<H", buf, self.vtable)[0]
+
+    def field(self, index):
+        slot = 4 + 2 * index
+        if slot >= self.vtable_len:
+            return None
+        offset = struct.unpack_from("<H", self.buf, self.vtable + slot)[0]
+        return self.pos + offset if offset else None
+
+    def scalar(self, index, fmt, default):
+        pos = self.field(index)
+        return struct.unpack_from(fmt, self.buf, pos)[0] if pos is not None else default
+
+    def tables(self, index):
+        pos = self.field(index)
+        if pos is None:
+            return []
+        vec = pos + struct.unpack_from("<I", self.buf, pos)[0]
+        count = struct.unpack_from("<I", self.buf, vec)[0]
+        result = []
+        for i in range(count):
+            elem = vec + 4 + 4 * i
+            result.append(Table(self.buf, elem + struct.unpack_from("<I", self.buf, elem)[0]))
+        return result
+
+
+def used_builtin_codes(model):
+    if model[4:8] != b"TFL3":
+        sys.exit("Not a TFLite flatbuffer")
+    root = Table(model, struct.unpack_from("<I", model, 0)[0])
+    codes = []
+    # Model.operator_codes is field 1
+    for op_code in root.tables(1):
+        # OperatorCode: deprecated_builtin_code (0), builtin_code (3)
+        deprecated = op_code.scalar(0, "<b", 0)
+        builtin = op_code.scalar(3, "<i", 0)
+        code = max(deprecated, builtin)
+        if code not in codes:
+            codes.append(code)
+    return codes
+
+
+def write_if_changed(path, text):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("model", help=".tflite file or ul_model_data.cpp")
+    parser.add_argument("output", help="header to write")
+    args = parser.parse_args()
+
+    methods = []
+    for code in used_builtin_codes(load_model(args.model)):
+        if code == BUILTIN_CUSTOM:
+            sys.exit("Model uses a custom op, register it by hand")
+        if code not in OP_TABLE:
+            sys.exit(f"Model uses builtin op {code}, add it to OP_TABLE")
+        methods.append(OP_TABLE[code])
+
+    text = TEMPLATE.format(source=os.path.basename(args.model), count=len(methods),
+                           calls="\n".join(CALL.format(method=m) for m in methods))
+    write_if_changed(args.output, text)
+
+
+if __name__ == "__main__":
+    main()
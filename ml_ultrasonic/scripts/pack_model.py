@@ -0,0 +1,55 @@
+"""
+Wrap a .tflite model in the image header checked by model_store.c.
+
+    python scripts/pack_model.py ../tflm_training/model_3.tflite model_image.bin
+
+The image then goes to one of the model slots (0x08040000 or 0x08060000
+with model_partition.overlay), without rebuilding the application, e.g.
+
+    st-flash write model_image.bin 0x08040000
+
+or over MQTT with scripts/publish_model.py. When both slots hold a valid
+image the firmware runs the one with the higher sequence number.
+"""
+import argparse
+import struct
+import time
+import zlib
+
+MAGIC = 0x444D4C55  # "ULMD"
+HEADER_VERSION = 2
+# TFLITE_SCHEMA_VERSION the firmware is built against
+SCHEMA_VERSION = 3
+
+
+# struct model_image_header, padded to 32 bytes
+HEADER_FORMAT = "<IHHIII12x"
+
+
+def pack(model, sequence):
+    if model[4:8] != b"TFL3":
+        raise ValueError("not a TFLite flatbuffer")
+    header = struct.pack(HEADER_FORMAT, MAGIC, HEADER_VERSION, SCHEMA_VERSION,
+                         len(model), zlib.crc32(model) & 0xFFFFFFFF, sequence)
+    return header + model
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("model", help=".tflite file")
+    parser.add_argument("output", help="image to write")
+    parser.add_argument("--sequence", type=int, default=int(time.time()),
+                        help="image sequence number (default: current unix time)")
+    args = parser.parse_args()
+
+    with open(args.model, "rb") as f:
+        model = f.read()
+    image = pack(model, args.sequence & 0xFFFFFFFF)
+    with open(args.output, "wb") as f:
+        f.write(image)
+    print(f"Packed {len(model)} byte model into {len(image)} byte image")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,54 @@
+"""
+Send a packed model image to the ultrasonic node over MQTT.
+
+    python scripts/pack_model.py ../tflm_training/model_3.tflite model_image.bin
+    python scripts/publish_model.py model_image.bin --broker localhost
+
+The node writes the image into its inactive model slot and switches to it at
+the next window boundary once the CRC checks out. For a native_sim build
+(west build -b native_sim -- -DUL_MODEL_IN_FLASH=ON -DUL_MQTT=ON
+-DUL_MQTT_BROKER=127.0.0.1) run a local broker with `mosquitto -v`.
+
+A node with no valid model, such as native_sim on a blank flash file or a
+freshly erased board, still connects and waits for one, so the first model
+is sent the same way.
+"""
+import argparse
+import struct
+
+import paho.mqtt.client as mqtt
+
+# Must match include/model_ota.h
+TOPIC = "zephyrus/green/ultrasonic/model"
+CHUNK_SIZE = 1024
+
+
+def chunks(image):
+    for offset in range(0, len(image), CHUNK_SIZE):
+        yield struct.pack("<II", len(image), offset) + image[offset:offset + CHUNK_SIZE]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="image from pack_model.py")
+    parser.add_argument("--broker", default="test.mosquitto.org")
+    parser.add_argument("--port", type=int, default=1883)
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+
+    client = mqtt.Client()
+    client.connect(args.broker, args.port)
+    client.loop_start()
+    # QoS 1 and one chunk in flight at a time keeps the chunks in order
+    for payload in chunks(image):
+        client.publish(TOPIC, payload, qos=1).wait_for_publish()
+    client.loop_stop()
+    client.disconnect()
+    print(f"Sent {len(image)} byte image in {(len(image) + CHUNK_SIZE - 1) // CHUNK_SIZE} chunks")
+
+
+if __name__ == "__main__":
+    main()
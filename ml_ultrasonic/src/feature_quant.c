@@ -0,0 +1,43 @@
+#include <errno.h>
+#include <stdint.h>
+#include "feature_quant.h"
+
+/**
+ * Precompute the fixed-point reciprocal of the model's input scale.
+ * Returns -EINVAL if the scale is too fine for the largest feature to fit
+ * a 32-bit product.
+ */
+int feature_quant_init(struct feature_quant *quant, float scale, int32_t zero_point) {
+    float multiplier = FEATURE_METRES_PER_ECHO_US / scale * (1 << FEATURE_QUANT_SHIFT);
+
+    if (!(scale > 0.0f) || multiplier * FEATURE_MAX_VALUE_US > (float)INT32_MAX) {
+        return -EINVAL;
+    }
+    quant->multiplier = (int32_t)(multiplier + 0.5f);
+    quant->zero_point = zero_point;
+    return 0;
+}
+
+/**
+ * Quantize a feature given in echo microseconds, |value_us| at most
+ * FEATURE_MAX_VALUE_US, to the model's uint8 input.
+ */
+uint8_t feature_quantize(const struct feature_quant *quant, int32_t value_us) {
+    int32_t product = value_us * quant->multiplier;
+    int32_t quantized_value;
+
+    // Round half away from zero, as round() did
+    if (product >= 0) {
+        quantized_value = (product + (1 << (FEATURE_QUANT_SHIFT - 1))) >> FEATURE_QUANT_SHIFT;
+    } else {
+        quantized_value = -((-product + (1 << (FEATURE_QUANT_SHIFT - 1))) >> FEATURE_QUANT_SHIFT);
+    }
+    quantized_value += quant->zero_point;
+    // Clip to the uint8 input
+    if (quantized_value < 0) {
+        quantized_value = 0;
+    } else if (quantized_value > UINT8_MAX) {
+        quantized_value = UINT8_MAX;
+    }
+    return (uint8_t)quantized_value;
+}
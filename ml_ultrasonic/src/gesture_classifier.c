@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "gesture_classifier.h"
+
+#define MAX_VOTE_WINDOW 32
+
+static struct gesture_config config = {
+    .threshold = {
+        [GESTURE_LOWER - 1] = 0,
+        [GESTURE_HIGHER - 1] = UL_GESTURE_HIGHER_THRESHOLD,
+        [GESTURE_NONE - 1] = UL_GESTURE_NONE_THRESHOLD,
+    },
+    .vote_window = UL_GESTURE_VOTE_WINDOW,
+    .vote_min = UL_GESTURE_VOTE_MIN,
+};
+
+/* Raw decisions of the last vote_window inferences, newest at vote_next - 1 */
+static uint8_t votes[MAX_VOTE_WINDOW];
+static uint8_t vote_next;
+static uint8_t vote_count;
+
+void gesture_classifier_init(const struct gesture_config *new_config) {
+    if (new_config != NULL) {
+        config = *new_config;
+    }
+    if (config.vote_window == 0) {
+        config.vote_window = 1;
+    } else if (config.vote_window > MAX_VOTE_WINDOW) {
+        config.vote_window = MAX_VOTE_WINDOW;
+    }
+    if (config.vote_min == 0 || config.vote_min > config.vote_window) {
+        config.vote_min = config.vote_window;
+    }
+    gesture_classifier_reset();
+}
+
+/**
+ * Forget the vote history, e.g. after the model has been replaced.
+ */
+void gesture_classifier_reset(void) {
+    memset(votes, 0, sizeof(votes));
+    vote_next = 0;
+    vote_count = 0;
+}
+
+/**
+ * Decide a single inference from the quantized model outputs, without
+ * dequantizing them.
+ */
+int gesture_classify(const uint8_t *output) {
+    if (output[GESTURE_NONE - 1] > config.threshold[GESTURE_NONE - 1]) {
+        return GESTURE_NONE;
+    }
+    if (output[GESTURE_HIGHER - 1] > config.threshold[GESTURE_HIGHER - 1]) {
+        return GESTURE_HIGHER;
+    }
+    return GESTURE_LOWER;
+}
+
+/**
+ * Add one inference to the vote window and return the category to report.
+ * A volume gesture is only reported once it has won vote_min of the last
+ * vote_window inferences, otherwise the result is GESTURE_NONE. The window
+ * is cleared after reporting so overlapping windows of one movement cannot
+ * trigger it twice.
+ */
+int gesture_classifier_update(const uint8_t *output) {
+    int raw = gesture_classify(output);
+
+    votes[vote_next] = (uint8_t)raw;
+    vote_next = (vote_next + 1) % config.vote_window;
+    if (vote_count < config.vote_window) {
+        vote_count++;
+    }
+
+    if (raw == GESTURE_NONE) {
+        return GESTURE_NONE;
+    }
+
+    int tally = 0;
+    for (int i = 0; i < vote_count; i++) {
+        if (votes[i] == raw) {
+            tally++;
+        }
+    }
+    if (tally < config.vote_min) {
+        return GESTURE_NONE;
+    }
+
+    gesture_classifier_reset();
+    return raw;
+}
@@ -1,9 +1,17 @@
 #include "main_functions.h"
+#include "feature_quant.h"
+#include "gesture_classifier.h"
 #include "ul_model_data.h"
+#include "model_store.h"
+#include "mqtt.h"
 #include "ultrasonic_handler.h"
+#include "ul_arena_size.h"
+#include "ul_op_resolver.h"
+#include <stdio.h>
+#include <string.h>
+#include <new>
 #include <tensorflow/lite/micro/micro_log.h>
 #include <tensorflow/lite/micro/micro_interpreter.h>
-#include <tensorflow/lite/micro/micro_mutable_op_resolver.h>
 #include <tensorflow/lite/schema/schema_generated.h>
 
 /* Globals, used for compatibility with Arduino-style sketches. */
@@ -12,176 +20,335 @@ namespace {
 	tflite::MicroInterpreter *interpreter = nullptr;
 	TfLiteTensor *model_input = nullptr;
 	int input_length;
+	bool model_ready = false;
 
 	/* Create an area of memory to use for input, output, and intermediate arrays.
-	* The size of this will depend on the model you're using, and may need to be
-	* determined by experimentation.
+	* The size is pinned in ul_arena_size.h by scripts/gen_arena_header.py,
+	* from arena_used_bytes() measured on the board.
+	* Profiling builds use a deliberately oversized arena so the model's real
+	* requirement can be measured rather than clipped.
 	*/
-	constexpr int kTensorArenaSize = 20 * 1024;
-	uint8_t tensor_arena[kTensorArenaSize];
+#ifdef UL_ARENA_PROFILE
+	constexpr int kTensorArenaSize = UL_ARENA_PROFILE_SIZE;
+#else
+	constexpr int kTensorArenaSize = UL_TENSOR_ARENA_SIZE;
+#endif
+	alignas(16) uint8_t tensor_arena[kTensorArenaSize];
+
+	/* Streaming window. The model always sees the most recent kWindowLength
+	 * samples and inference runs once every kHopSize new samples, so a
+	 * gesture is looked at within kHopSize sample periods instead of waiting
+	 * for a whole fresh window. A hop of kWindowLength gives the original
+	 * back-to-back batches.
+	 */
+	constexpr int kWindowLength = 30;
+#ifdef UL_HOP_SIZE
+	constexpr int kHopSize = UL_HOP_SIZE;
+#else
+	constexpr int kHopSize = 5;
+#endif
+	static_assert(kHopSize > 0 && kHopSize <= kWindowLength,
+		      "hop size must be between 1 and the window length");
+
+	/* Quantised feature columns kept as rings. Every value is written twice,
+	 * kWindowLength apart, so the current window is always one contiguous
+	 * run starting at the slot of its oldest sample.
+	 */
+	uint8_t q_dist[2 * kWindowLength];
+	uint8_t q_vel[2 * kWindowLength];
+	uint8_t q_accel[2 * kWindowLength];
+
+	uint32_t samples_seen;
+	int32_t prev_dist;
+	int32_t prev_vel;
+
+	constexpr int32_t kMaxEchoUs = FEATURE_MAX_ECHO_US;
+	static_assert(kMaxEchoUs == static_cast<int32_t>(ULTRASONIC_MAX_RANGE_M / FEATURE_METRES_PER_ECHO_US + 0.5f),
+		      "FEATURE_MAX_ECHO_US must match ULTRASONIC_MAX_RANGE_M");
+
+	struct feature_quant input_quant;
+
+	int32_t sample_to_echo_us(const struct ultrasonic_sample *sample)
+	{
+		if (!sample->valid || sample->duration > static_cast<uint32_t>(kMaxEchoUs)) {
+			// Out of range or no echo at all both read as the furthest distance
+			return kMaxEchoUs;
+		}
+		return static_cast<int32_t>(sample->duration);
+	}
+
+	void ring_store(uint8_t *ring, uint32_t sample, uint8_t value)
+	{
+		int slot = sample % kWindowLength;
+
+		ring[slot] = value;
+		ring[slot + kWindowLength] = value;
+	}
+} /* namespace */
+
+namespace {
+	/* The op resolver outlives any one interpreter, so models can be swapped
+	 * without registering the ops again.
+	 */
+	UlOpResolver micro_op_resolver; /* NOLINT */
+	alignas(tflite::MicroInterpreter) uint8_t interpreter_buffer[sizeof(tflite::MicroInterpreter)];
+	const uint8_t *active_model_data = nullptr;
+
+	void stop_interpreter(void)
+	{
+		if (interpreter) {
+			interpreter->~MicroInterpreter();
+			interpreter = nullptr;
+		}
+		model_input = nullptr;
+		model_ready = false;
+	}
+
+	/* Build an interpreter for model_data in the shared arena and check its
+	 * input matches the feature stage. Returns false, with no interpreter
+	 * left running, if the model cannot be used.
+	 */
+	bool start_interpreter(const uint8_t *model_data)
+	{
+		/* Map the model into a usable data structure. This doesn't involve any
+		 * copying or parsing, it's a very lightweight operation.
+		 */
+		model = tflite::GetModel(model_data);
+		if (model->version() != TFLITE_SCHEMA_VERSION) {
+			printf("Model provided is schema version %d not equal "
+					    "to supported version %d.",
+					    model->version(), TFLITE_SCHEMA_VERSION);
+			return false;
+		}
+
+		/* Build an interpreter to run the model with. */
+		interpreter = new (interpreter_buffer) tflite::MicroInterpreter(
+			model, micro_op_resolver, tensor_arena, kTensorArenaSize);
+
+		/* Allocate memory from the tensor_arena for the model's tensors. */
+		if (interpreter->AllocateTensors() != kTfLiteOk) {
+			printf("AllocateTensors() failed with a %d byte arena, "
+			       "regenerate ul_arena_size.h for this model\n", kTensorArenaSize);
+			stop_interpreter();
+			return false;
+		}
+		/* scripts/gen_arena_header.py picks this line out of the log. The
+		 * pointer size tells it whether this build's use applies to the board.
+		 */
+		printf("arena_used_bytes=%u of %d ptr=%u\n",
+		       static_cast<unsigned int>(interpreter->arena_used_bytes()), kTensorArenaSize,
+		       static_cast<unsigned int>(sizeof(void *)));
+
+		/* Obtain pointer to the model's input tensor. */
+		model_input = interpreter->input(0);
+		if (!model_input) {
+			printf("model_input is NULL\n");
+			stop_interpreter();
+			return false;
+		}
+		if ((model_input->dims->size != 3) ||
+		    (model_input->dims->data[0] != 1) ||
+		    (model_input->dims->data[1] != 30) ||
+		    (model_input->dims->data[2] != 3) ||
+		    (model_input->type != kTfLiteUInt8)) {
+			printf("model_input->type = %d (expected %d)\n", model_input->type, kTfLiteUInt8);
+			printf("Bad input tensor parameters in model\n");
+			for (int i = 0; i < model_input->dims->size; i++) {
+				printf("%d ", model_input->dims->data[i]);
+			}
+			stop_interpreter();
+			return false;
+		}
+
+		input_length = model_input->bytes / sizeof(uint8_t);
+
+		/* The gesture thresholds are compared with the raw uint8 outputs. */
+		TfLiteTensor *output = interpreter->output(0);
+		if (!output || output->type != kTfLiteUInt8 || output->bytes < GESTURE_CLASSES) {
+			printf("Bad output tensor parameters in model\n");
+			stop_interpreter();
+			return false;
+		}
+		if (output->params.zero_point != GESTURE_OUTPUT_ZERO_POINT ||
+		    output->params.scale != GESTURE_OUTPUT_SCALE) {
+			printf("Output scale %f zero point %d, gesture thresholds assume 1/256 and 0\n",
+			       static_cast<double>(output->params.scale),
+			       static_cast<int>(output->params.zero_point));
+		}
+
+		/* Precompute the fixed-point reciprocal of the input scale. */
+		if (feature_quant_init(&input_quant, model_input->params.scale,
+				       model_input->params.zero_point) != 0) {
+			printf("Input scale %f too fine for fixed-point features\n",
+			       static_cast<double>(model_input->params.scale));
+			stop_interpreter();
+			return false;
+		}
+
+		active_model_data = model_data;
+		model_ready = true;
+		return true;
+	}
+
+#ifdef UL_MODEL_OTA
+	/* Switch to a model that arrived over MQTT, if one is waiting. Called
+	 * between windows; the quantised history was scaled for the old model's
+	 * input, so the window starts filling again from scratch.
+	 */
+	void swap_pending_model(void)
+	{
+		size_t length;
+		const uint8_t *candidate = model_store_take_pending(&length);
+		if (!candidate) {
+			return;
+		}
+
+		const uint8_t *previous = active_model_data;
+		stop_interpreter();
+		bool accepted = start_interpreter(candidate);
+		if (!accepted && previous) {
+			printf("New model rejected, keeping the current one\n");
+			start_interpreter(previous);
+		} else if (!accepted) {
+			printf("New model rejected, still waiting for one\n");
+		} else {
+			printf("Switched to new %u byte model\n", static_cast<unsigned int>(length));
+		}
+		model_store_confirm(accepted);
+		samples_seen = 0;
+		gesture_classifier_reset();
+	}
+#endif
 } /* namespace */
 
 /* The name of this function is important for Arduino compatibility. */
 void setup(void)
 {
-	/* Map the model into a usable data structure. This doesn't involve any
-	 * copying or parsing, it's a very lightweight operation.
+	/* Pull in only the operation implementations this graph uses.
+	 * ul_op_resolver.h is generated from the model at build time by
+	 * scripts/gen_op_resolver.py, so the list always matches the model.
 	 */
-	 
-	model = tflite::GetModel(model_tflite);
-	if (model->version() != TFLITE_SCHEMA_VERSION) {
-		printf("Model provided is schema version %d not equal "
-				    "to supported version %d.",
-				    model->version(), TFLITE_SCHEMA_VERSION);
+	if (ul_register_ops(micro_op_resolver) != kTfLiteOk) {
+		printf("Failed to register model ops\n");
 		return;
 	}
 
-	/* Pull in only the operation implementations we need.
-	 * This relies on a complete list of all the ops needed by this graph.
-	 * An easier approach is to just use the AllOpsResolver, but this will
-	 * incur some penalty in code space for op implementations that are not
-	 * needed by this graph.
-	 */
-	
-	static tflite::MicroMutableOpResolver < 10 > micro_op_resolver; /* NOLINT */
-	micro_op_resolver.AddConv2D();
-	micro_op_resolver.AddRelu();
-	micro_op_resolver.AddFullyConnected();
-	micro_op_resolver.AddSoftmax();
-	micro_op_resolver.AddReshape();
-	micro_op_resolver.AddQuantize();
-	micro_op_resolver.AddDequantize();
-	micro_op_resolver.AddExpandDims();
-
-	/* Build an interpreter to run the model with. */
-	static tflite::MicroInterpreter static_interpreter(
-		model, micro_op_resolver, tensor_arena, kTensorArenaSize);
-	interpreter = &static_interpreter;
-
-	/* Allocate memory from the tensor_arena for the model's tensors. */
-	interpreter->AllocateTensors();
-
-	/* Obtain pointer to the model's input tensor. */
-	model_input = interpreter->input(0);
-	if (!model_input) {
-    	printf("model_input is NULL\n");
-    	return;
+	/* In flash builds the model is used in place from its own partition. */
+#ifdef UL_MODEL_IN_FLASH
+	size_t model_length;
+	const uint8_t *model_data = model_store_load(TFLITE_SCHEMA_VERSION, &model_length);
+	if (!model_data) {
+		printf("No valid model in the model partition\n");
 	}
-	if ((model_input->dims->size != 3) ||
-	    (model_input->dims->data[0] != 1) ||
-	    (model_input->dims->data[1] != 30) ||
-        (model_input->dims->data[2] != 3) ||
-	    (model_input->type != kTfLiteUInt8)) {
-		printf("model_input->type = %d (expected %d)\n", model_input->type, kTfLiteUInt8);
-		printf("Bad input tensor parameters in model\n");
-		for (int i = 0; i < model_input->dims->size; i++) {
-    		printf("%d ", model_input->dims->data[i]);
-		}
+#else
+	const uint8_t *model_data = model_tflite;
+#endif
+	if (!model_data || !start_interpreter(model_data)) {
+#ifdef UL_MODEL_OTA
+		/* A blank or bad partition is fixed by sending a model, so keep
+		 * sampling and start MQTT anyway. loop() waits for the model.
+		 */
+		printf("Waiting for a model over MQTT\n");
+#else
 		return;
+#endif
 	}
 
-	input_length = model_input->bytes / sizeof(int8_t);
-	
+	gesture_classifier_init(nullptr);
 	ultrasonic_init();
+#ifdef UL_MQTT
+	/* Model updates may only start once the active slot is known. */
+	mqtt_start();
+#endif
+}
+
+size_t model_arena_used_bytes(void)
+{
+	if (!model_ready) {
+		return 0;
+	}
+	return interpreter->arena_used_bytes();
 }
 
 void loop(void)
 {
-    static float ul_buff[30];
-    static int ref_index = 0;
-	
-	ul_buff[ref_index++] = ultrasonic_read();
-	//printf("%f\n", ul_buff[ref_index - 1]);
+	struct ultrasonic_sample sample;
+	ultrasonic_get_sample(&sample);
 
-	//printf("%d, %f\n", ref_index - 1, ul_buff[ref_index - 1]);
-	
-    if (ref_index < 30) {
-        // Needs more sampling to complete the time series
-        return;
-    }
+	if (!model_ready) {
+#ifdef UL_MODEL_OTA
+		// Nothing to run yet, look for a model once per sample
+		swap_pending_model();
+#endif
+		return;
+	}
 
-    // Full time series collected
-    ref_index = 0;
+	int32_t dist = sample_to_echo_us(&sample);
+	uint32_t n = samples_seen++;
 
-	// Calculate necessary information from time series
-	static float vel[30];
-	for (int i = 0; i < 29; i++) {
-		vel[i] = ul_buff[i + 1] - ul_buff[i];
+	// Only the newest differences change when a sample arrives:
+	// vel[n - 1] = x[n] - x[n - 1] and accel[n - 2] = vel[n - 1] - vel[n - 2]
+	ring_store(q_dist, n, feature_quantize(&input_quant, dist));
+	if (n >= 1) {
+		int32_t vel = dist - prev_dist;
+		ring_store(q_vel, n - 1, feature_quantize(&input_quant, vel));
+		if (n >= 2) {
+			ring_store(q_accel, n - 2, feature_quantize(&input_quant, vel - prev_vel));
+		}
+		prev_vel = vel;
 	}
-	vel[29] = vel[28];
-	static float accel[30];
-	for (int i = 0; i < 28; i++) {
-		accel[i] = vel[i + 1] - vel[i];
+	prev_dist = dist;
+
+	if (samples_seen < kWindowLength ||
+	    (samples_seen - kWindowLength) % kHopSize != 0) {
+		// Needs more sampling before the next inference
+		return;
 	}
-	accel[28] = accel[27];
-	accel[29] = accel[28];
-	
-    // Quantisation
-    for (int i = 0; i < 30; i++) {
-        int32_t quantized_value = static_cast<int32_t>(round(ul_buff[i] / model_input->params.scale) + model_input->params.zero_point);
-        // Clip Quantised Values
-        quantized_value = std::max(-128, quantized_value);
-        quantized_value = std::min(127, quantized_value);
-        model_input->data.int8[i] = static_cast<int8_t>(quantized_value);
-
-		quantized_value = static_cast<int32_t>(round(vel[i] / model_input->params.scale) + model_input->params.zero_point);
-        // Clip Quantised Values
-        quantized_value = std::max(-128, quantized_value);
-        quantized_value = std::min(127, quantized_value);
-        model_input->data.int8[i + 30] = static_cast<int8_t>(quantized_value);
-
-		quantized_value = static_cast<int32_t>(round(accel[i] / model_input->params.scale) + model_input->params.zero_point);
-        // Clip Quantised Values
-        quantized_value = std::max(-128, quantized_value);
-        quantized_value = std::min(127, quantized_value);
-        model_input->data.int8[i + 60] = static_cast<int8_t>(quantized_value);
-    }
-	
+
+#ifdef UL_MODEL_OTA
+	swap_pending_model();
+	if (!model_ready || samples_seen == 0) {
+		return;
+	}
+#endif
+
+	// Copy out the window holding samples n - 29 .. n
+	int oldest = samples_seen % kWindowLength;
+	uint8_t *input = model_input->data.uint8;
+	memcpy(&input[0], &q_dist[oldest], kWindowLength);
+	memcpy(&input[kWindowLength], &q_vel[oldest], kWindowLength);
+	memcpy(&input[2 * kWindowLength], &q_accel[oldest], kWindowLength);
+
+	// The tail of each difference column repeats its last value, the same
+	// edge handling as the baseline's whole-window differences
+	input[2 * kWindowLength - 1] = input[2 * kWindowLength - 2];
+	input[3 * kWindowLength - 2] = input[3 * kWindowLength - 3];
+	input[3 * kWindowLength - 1] = input[3 * kWindowLength - 3];
 
 	/* Run inference, and report any error */
 	
 	TfLiteStatus invoke_status = interpreter->Invoke();
 	if (invoke_status != kTfLiteOk) {
-		printf("Invoke failed on index: %d\n", ref_index);
+		printf("Invoke failed on sample: %u\n", (unsigned int)n);
 		return;
 	}
-	TfLiteTensor* output = interpreter->output(0);
-	int8_t* quantized_prob_dist = output->data.int8;
-	float dequantized_prob_dist[3] = {0};
-    int max_likelihood_index = 0;
-	//printf("Zero Point: %d\n", output->params.zero_point);
-	//printf("Scale: %f\n", output->params.scale);
-	for (int i = 0; i < 3; i++) {
-		dequantized_prob_dist[i] = output->params.scale * (quantized_prob_dist[i] - output->params.zero_point);
-		//printf("Prob-Dist: %d, %d, %f\n", i, quantized_prob_dist[i], dequantized_prob_dist[i]);
-	}
-    for (int i = 0; i < 3; i++) {
-        if ((dequantized_prob_dist[i] > dequantized_prob_dist[max_likelihood_index]) && i != 2) {
-            max_likelihood_index = i;
-        }
-		//printf("Prob-Dist: %d, %d\n", i, quantized_prob_dist[i]);
-		
-    }
-    
-    int selected_category = max_likelihood_index + 1;
-	if (quantized_prob_dist[2] > 2) {
-		selected_category = 3;
-	} else if (quantized_prob_dist[1] > -6) {
-		selected_category = 2;
-	} else {
-		selected_category = 1;
+	int selected_category = gesture_classifier_update(interpreter->output(0)->data.uint8);
+#ifdef UL_MQTT
+	/* Straight to the broker, timestamped with the newest sample so the
+	 * receiver can measure latency from the end of the gesture.
+	 */
+	if (selected_category != GESTURE_NONE) {
+		mqtt_publish_gesture(selected_category, sample.timestamp);
 	}
-	//printf("selected=%d\n", selected_category);
+#else
 	ultrasonic_publish(selected_category);
-	if (selected_category == 1) {
+#endif
+	// Inferences come every hop, so only a voted gesture is printed
+	if (selected_category == GESTURE_LOWER) {
         // Swipe down towards
         printf("Lower Volume\n");
-    } else if (selected_category == 2) {
+    } else if (selected_category == GESTURE_HIGHER) {
         // Swipe up away
         printf("Higher Volume\n");
-    } else if (selected_category == 3) {
-        // Swipe across
-        printf("No Gesture Detected ...\n");
     }
-    // Else remain IDLE
-}
\ No newline at end of file
+}
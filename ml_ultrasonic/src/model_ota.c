@@ -0,0 +1,159 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "model_ota.h"
+#include "model_store.h"
+
+/* TFLITE_SCHEMA_VERSION, which is only available from the C++ headers */
+#define MODEL_SCHEMA_VERSION 3
+
+/* Image bytes read off the socket and written to flash at a time */
+#define MODEL_OTA_PIECE_SIZE 256
+
+BUILD_ASSERT(MODEL_OTA_PIECE_SIZE % MODEL_WRITE_ALIGN == 0, "pieces must keep flash writes aligned");
+BUILD_ASSERT(MODEL_OTA_PIECE_SIZE >= sizeof(struct model_image_header),
+             "the first piece must hold the image header");
+
+static bool transfer_active;
+static size_t transfer_total;
+static size_t next_offset;
+
+/* The image header's CRC and sequence name a transfer. Those of the
+ * current one, and of the last one written, whose chunks QoS 1 may still
+ * deliver after it has finished.
+ */
+struct transfer_id {
+    size_t total;
+    uint32_t crc32;
+    uint32_t sequence;
+};
+static struct transfer_id transfer_id;
+static bool transfer_identified;
+static struct transfer_id completed_id;
+static bool have_completed;
+
+static bool first_chunk_id(uint32_t total, const uint8_t *data, size_t data_len,
+                           struct transfer_id *id) {
+    if (data_len < sizeof(struct model_image_header)) {
+        return false;
+    }
+    id->total = total;
+    id->crc32 = sys_get_le32(data + offsetof(struct model_image_header, crc32));
+    id->sequence = sys_get_le32(data + offsetof(struct model_image_header, sequence));
+    return true;
+}
+
+static bool same_transfer(const struct transfer_id *a, const struct transfer_id *b) {
+    return a->total == b->total && a->crc32 == b->crc32 && a->sequence == b->sequence;
+}
+
+static int abort_transfer(int ret) {
+    model_store_update_abort();
+    transfer_active = false;
+    return ret;
+}
+
+/**
+ * Feed one MQTT message of a model transfer into the inactive model slot,
+ * reading it off the socket a piece at a time. The finished image is
+ * verified and handed to the inference thread, which switches to it at the
+ * next window boundary.
+ */
+int model_ota_handle_chunk(struct zg_mqtt_message *msg, size_t len) {
+    uint8_t header[sizeof(struct model_chunk_header)];
+    uint8_t piece[MODEL_OTA_PIECE_SIZE];
+    int ret;
+
+    if (len < sizeof(header)) {
+        printf("Model chunk too short: %u\n", (unsigned int)len);
+        return -EINVAL;
+    }
+    size_t data_len = len - sizeof(header);
+    size_t piece_len = MIN(data_len, sizeof(piece));
+    // The first piece holds the image header of an offset 0 chunk
+    ret = zg_mqtt_read(msg, header, sizeof(header));
+    if (ret == 0) {
+        ret = zg_mqtt_read(msg, piece, piece_len);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    uint32_t total = sys_get_le32(header);
+    uint32_t offset = sys_get_le32(header + 4);
+
+    // QoS 1 may deliver a chunk again, the first one included
+    bool repeated = transfer_active && total == transfer_total && offset < next_offset;
+    struct transfer_id id;
+
+    if (offset == 0 && !repeated && first_chunk_id(total, piece, piece_len, &id) &&
+        have_completed && same_transfer(&id, &completed_id)) {
+        // The finished transfer again, beginning it would erase the slot
+        // holding the previous model
+        return 0;
+    }
+    if (offset == 0 && !repeated) {
+        if (transfer_active) {
+            printf("Model transfer restarted\n");
+        }
+        ret = model_store_update_begin(total);
+        if (ret < 0) {
+            printf("Cannot start model transfer: %d\n", ret);
+            transfer_active = false;
+            return ret;
+        }
+        transfer_active = true;
+        transfer_total = total;
+        next_offset = 0;
+        transfer_identified = first_chunk_id(total, piece, piece_len, &transfer_id);
+        printf("Receiving %u byte model\n", total);
+    }
+
+    if (!transfer_active) {
+        // Joined part way through, wait for the next offset 0
+        return -EAGAIN;
+    }
+    if (repeated && offset + data_len <= next_offset) {
+        // Already written, the broker only resent it
+        return 0;
+    }
+    if (total != transfer_total || offset != next_offset ||
+        data_len == 0 || offset + data_len > transfer_total) {
+        printf("Model chunk at %u out of sequence, expected %u\n", offset, (unsigned int)next_offset);
+        return abort_transfer(-EINVAL);
+    }
+
+    for (size_t done = 0; done < data_len; done += piece_len) {
+        if (done > 0) {
+            piece_len = MIN(data_len - done, sizeof(piece));
+            ret = zg_mqtt_read(msg, piece, piece_len);
+            if (ret < 0) {
+                // Flash cannot be written twice, so a redelivery could
+                // not finish this chunk
+                printf("Model transfer lost with the connection: %d\n", ret);
+                return abort_transfer(ret);
+            }
+        }
+        ret = model_store_update_write(offset + done, piece, piece_len);
+        if (ret < 0) {
+            printf("Model slot write failed: %d\n", ret);
+            return abort_transfer(ret);
+        }
+    }
+    next_offset += data_len;
+
+    if (next_offset == transfer_total) {
+        transfer_active = false;
+        ret = model_store_update_finish(MODEL_SCHEMA_VERSION);
+        if (ret == 0) {
+            completed_id = transfer_id;
+            have_completed = transfer_identified;
+        }
+        return ret;
+    }
+    return 0;
+}
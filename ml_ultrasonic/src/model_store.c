@@ -0,0 +1,274 @@
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "model_store.h"
+
+#ifdef CONFIG_FLASH_SIMULATOR
+#include <zephyr/drivers/flash/flash_simulator.h>
+#endif
+
+#define MODEL_SLOT_COUNT 2
+#define NO_SLOT -1
+
+/* Update state, handed between the network and inference threads */
+enum {
+    UPDATE_IDLE,
+    UPDATE_WRITING,     /* Network thread is filling the inactive slot */
+    UPDATE_PENDING,     /* Verified image waiting for a window boundary */
+    UPDATE_SWAPPING,    /* Inference thread is trying the new image */
+};
+
+static const uint8_t slot_ids[MODEL_SLOT_COUNT] = {
+    FIXED_PARTITION_ID(model_slot0),
+    FIXED_PARTITION_ID(model_slot1),
+};
+
+static int active_slot = NO_SLOT;
+static uint32_t active_sequence;
+static int update_slot = NO_SLOT;
+static size_t update_size;
+static atomic_t update_state = ATOMIC_INIT(UPDATE_IDLE);
+
+/**
+ * Address the slot is readable at. Internal flash is memory mapped, so the
+ * model can be used in place; the native_sim flash simulator keeps its
+ * contents in a RAM buffer instead.
+ */
+static const uint8_t *slot_base(const struct flash_area *fa) {
+#ifdef CONFIG_FLASH_SIMULATOR
+    size_t size;
+    return (const uint8_t *)flash_simulator_get_memory(fa->fa_dev, &size) + fa->fa_off;
+#else
+    return (const uint8_t *)DT_REG_ADDR(DT_CHOSEN(zephyr_flash)) + fa->fa_off;
+#endif
+}
+
+/**
+ * Check the image in a slot and return its header, or NULL if the slot does
+ * not hold a usable model. Nothing is copied.
+ */
+static const struct model_image_header *slot_validate(int slot, uint32_t schema_version) {
+    const struct flash_area *fa;
+    int ret = flash_area_open(slot_ids[slot], &fa);
+    if (ret < 0) {
+        printf("Failed to open model slot %d: %d\n", slot, ret);
+        return NULL;
+    }
+    size_t slot_size = fa->fa_size;
+    const struct model_image_header *header = (const struct model_image_header *)slot_base(fa);
+    flash_area_close(fa);
+
+    const uint8_t *model = (const uint8_t *)(header + 1);
+
+    if (header->magic != MODEL_IMAGE_MAGIC) {
+        printf("No model image in slot %d\n", slot);
+        return NULL;
+    }
+    if (header->header_version != MODEL_IMAGE_VERSION) {
+        printf("Unsupported model image version %u in slot %d\n", header->header_version, slot);
+        return NULL;
+    }
+    if (header->schema_version != schema_version) {
+        printf("Model image in slot %d is schema version %u, expected %u\n",
+               slot, header->schema_version, schema_version);
+        return NULL;
+    }
+    if (header->length == 0 || header->length > slot_size - sizeof(*header)) {
+        printf("Model image length %u does not fit slot %d\n", header->length, slot);
+        return NULL;
+    }
+    uint32_t crc = crc32_ieee(model, header->length);
+    if (crc != header->crc32) {
+        printf("Model image in slot %d has CRC 0x%08x, expected 0x%08x\n",
+               slot, crc, header->crc32);
+        return NULL;
+    }
+    return header;
+}
+
+static int slot_erase(int slot) {
+    const struct flash_area *fa;
+    int ret = flash_area_open(slot_ids[slot], &fa);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = flash_area_erase(fa, 0, fa->fa_size);
+    flash_area_close(fa);
+    return ret;
+}
+
+/**
+ * Pick the newest valid image out of the two slots and return a pointer to
+ * the flatbuffer inside it, or NULL if neither slot holds a usable model.
+ */
+const uint8_t *model_store_load(uint32_t schema_version, size_t *length) {
+    const struct model_image_header *best = NULL;
+
+    for (int slot = 0; slot < MODEL_SLOT_COUNT; slot++) {
+        const struct model_image_header *header = slot_validate(slot, schema_version);
+        if (header && (!best || header->sequence > best->sequence)) {
+            best = header;
+            active_slot = slot;
+        }
+    }
+    if (!best) {
+        return NULL;
+    }
+
+    active_sequence = best->sequence;
+    printf("Loaded %u byte model %u from slot %d\n", best->length, best->sequence, active_slot);
+    *length = best->length;
+    return (const uint8_t *)(best + 1);
+}
+
+/**
+ * Erase the inactive slot ready for an image of image_size bytes. Only one
+ * update runs at a time, and not while a finished one is still waiting to
+ * be swapped in.
+ */
+int model_store_update_begin(size_t image_size) {
+    if (!atomic_cas(&update_state, UPDATE_IDLE, UPDATE_WRITING)) {
+        // A retransmitted first chunk restarts the current transfer
+        if (atomic_get(&update_state) != UPDATE_WRITING) {
+            return -EBUSY;
+        }
+    }
+
+    update_slot = (active_slot == 0) ? 1 : 0;
+
+    const struct flash_area *fa;
+    int ret = flash_area_open(slot_ids[update_slot], &fa);
+    if (ret < 0) {
+        atomic_set(&update_state, UPDATE_IDLE);
+        return ret;
+    }
+    size_t slot_size = fa->fa_size;
+    flash_area_close(fa);
+
+    if (image_size <= sizeof(struct model_image_header) || image_size > slot_size) {
+        printf("Model image of %u bytes does not fit slot %d\n", (unsigned int)image_size, update_slot);
+        atomic_set(&update_state, UPDATE_IDLE);
+        return -EFBIG;
+    }
+
+    ret = slot_erase(update_slot);
+    if (ret < 0) {
+        printf("Failed to erase model slot %d: %d\n", update_slot, ret);
+        atomic_set(&update_state, UPDATE_IDLE);
+        return ret;
+    }
+    update_size = image_size;
+    return 0;
+}
+
+int model_store_update_write(size_t offset, const uint8_t *data, size_t len) {
+    if (atomic_get(&update_state) != UPDATE_WRITING) {
+        return -EINVAL;
+    }
+    if (offset % MODEL_WRITE_ALIGN != 0 || offset + len > update_size) {
+        return -EINVAL;
+    }
+
+    const struct flash_area *fa;
+    int ret = flash_area_open(slot_ids[update_slot], &fa);
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t aligned_len = ROUND_DOWN(len, MODEL_WRITE_ALIGN);
+    if (aligned_len > 0) {
+        ret = flash_area_write(fa, offset, data, aligned_len);
+    }
+    if (ret == 0 && aligned_len < len) {
+        // Only the end of the image may be unaligned, pad it with erased bytes
+        uint8_t tail[MODEL_WRITE_ALIGN];
+        memset(tail, 0xff, sizeof(tail));
+        memcpy(tail, data + aligned_len, len - aligned_len);
+        ret = flash_area_write(fa, offset + aligned_len, tail, sizeof(tail));
+    }
+    flash_area_close(fa);
+    return ret;
+}
+
+/**
+ * Verify the image just written and queue it for the inference thread.
+ * Images no newer than the running model are refused.
+ */
+int model_store_update_finish(uint32_t schema_version) {
+    if (atomic_get(&update_state) != UPDATE_WRITING) {
+        return -EINVAL;
+    }
+
+    const struct model_image_header *header = slot_validate(update_slot, schema_version);
+    if (!header) {
+        model_store_update_abort();
+        return -EBADMSG;
+    }
+    if (active_slot != NO_SLOT && header->sequence <= active_sequence) {
+        printf("Model %u is not newer than running model %u\n", header->sequence, active_sequence);
+        model_store_update_abort();
+        return -EALREADY;
+    }
+
+    printf("Model %u ready in slot %d\n", header->sequence, update_slot);
+    atomic_set(&update_state, UPDATE_PENDING);
+    return 0;
+}
+
+void model_store_update_abort(void) {
+    if (atomic_cas(&update_state, UPDATE_WRITING, UPDATE_IDLE)) {
+        // Stop a half-written image from being picked up on the next boot
+        slot_erase(update_slot);
+    }
+}
+
+/**
+ * Returns the newly written model if one is waiting, moving it into the
+ * swapping state until model_store_confirm() is called.
+ */
+const uint8_t *model_store_take_pending(size_t *length) {
+    if (!atomic_cas(&update_state, UPDATE_PENDING, UPDATE_SWAPPING)) {
+        return NULL;
+    }
+
+    const struct flash_area *fa;
+    if (flash_area_open(slot_ids[update_slot], &fa) < 0) {
+        atomic_set(&update_state, UPDATE_IDLE);
+        return NULL;
+    }
+    const struct model_image_header *header = (const struct model_image_header *)slot_base(fa);
+    flash_area_close(fa);
+
+    *length = header->length;
+    return (const uint8_t *)(header + 1);
+}
+
+/**
+ * Make the swapped-in model the active one, or erase it if the interpreter
+ * would not accept it so it is not chosen on the next boot either.
+ */
+void model_store_confirm(bool accepted) {
+    if (atomic_get(&update_state) != UPDATE_SWAPPING) {
+        return;
+    }
+
+    if (accepted) {
+        const struct flash_area *fa;
+        if (flash_area_open(slot_ids[update_slot], &fa) == 0) {
+            const struct model_image_header *header =
+                (const struct model_image_header *)slot_base(fa);
+            active_sequence = header->sequence;
+            flash_area_close(fa);
+        }
+        active_slot = update_slot;
+    } else {
+        slot_erase(update_slot);
+    }
+    atomic_set(&update_state, UPDATE_IDLE);
+}
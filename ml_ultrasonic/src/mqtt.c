@@ -0,0 +1,47 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdio.h>
+#include <zg_mqtt.h>
+#include "mqtt.h"
+#ifdef UL_MODEL_OTA
+#include "model_ota.h"
+#endif
+
+static uint32_t gesture_seq;
+
+#ifdef UL_MODEL_OTA
+static void model_chunk_received(const char *topic, struct zg_mqtt_message *msg, size_t len, void *user_data) {
+    model_ota_handle_chunk(msg, len);
+}
+#endif
+
+/**
+ * Let the network thread connect. Held back until setup() has picked the
+ * active model slot, so an update can never land on the slot in use.
+ * Builds with the model compiled in only publish gestures.
+ */
+void mqtt_start(void) {
+#ifdef UL_MODEL_OTA
+    int ret = zg_mqtt_subscribe(MODEL_OTA_TOPIC, MQTT_QOS_1_AT_LEAST_ONCE, model_chunk_received, NULL);
+    if (ret < 0) {
+        printf("Failed to subscribe to model updates: %d\n", ret);
+    }
+#endif
+    zg_mqtt_start();
+}
+
+/**
+ * Queue a gesture for the broker, from the inference loop. Never blocks;
+ * while disconnected or with the queue full the gesture is dropped, which
+ * the receiver sees as a gap in the sequence numbers.
+ */
+void mqtt_publish_gesture(int category, uint32_t sample_ms) {
+    uint8_t payload[GESTURE_PAYLOAD_LEN];
+
+    sys_put_le32(gesture_seq++, &payload[0]);
+    sys_put_le32(sample_ms, &payload[4]);
+    sys_put_le32(k_uptime_get_32(), &payload[8]);
+    payload[12] = (uint8_t)category;
+
+    zg_mqtt_publish(GESTURE_TOPIC, payload, sizeof(payload), MQTT_QOS_0_AT_MOST_ONCE);
+}
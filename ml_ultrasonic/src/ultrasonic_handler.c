@@ -5,11 +5,35 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/timer/system_timer.h>
 #include <zephyr/sys/time_units.h>
+#include <zephyr/sys/atomic.h>
 #include <stdlib.h>
 #include <math.h>
 #include "ultrasonic_handler.h"
 
 
+#define TRIG_PIN 9
+#define ECHO_PIN 8
+
+#define SAMPLE_PERIOD_MS 50
+/* A 3 m round trip takes ~17.5 ms, anything slower is treated as no echo */
+#define ECHO_TIMEOUT_MS 30
+
+/* Must be a power of two */
+#define SAMPLE_QUEUE_LEN 16
+
+#define SAMPLER_STACK_SIZE 1024
+#define SAMPLER_PRIORITY -2
+
+/* Pins toggled towards the MQTT bridge, one per volume gesture */
+#define SIGNAL_LOWER_PIN 5
+#define SIGNAL_HIGHER_PIN 6
+/* Gestures closer together than this are dropped rather than signalled */
+#define SIGNAL_HOLDOFF_MS 500
+#define SIGNAL_QUEUE_LEN 4
+
+#define SIGNALLER_STACK_SIZE 512
+#define SIGNALLER_PRIORITY 5
+
 //static const struct device *trig_port = DEVICE_DT_GET(DT_NODELABEL(gpio0)); // ESP32
 //static const struct device *echo_port = DEVICE_DT_GET(DT_NODELABEL(gpio0));
 static const struct device *trig_port = DEVICE_DT_GET(DT_NODELABEL(gpiob)); // Nucleo (For sampling)
@@ -17,67 +41,174 @@ static const struct device *echo_port = DEVICE_DT_GET(DT_NODELABEL(gpiob));
 static const struct device *mqtt_port = DEVICE_DT_GET(DT_NODELABEL(gpioa));
 static struct gpio_callback pulse_info;
 
-uint32_t pulse_start_time;
-uint32_t pulse_duration;
-uint8_t pulse_active = 0;
+static volatile uint32_t pulse_start_cycles;
+static volatile uint32_t pulse_duration;
+static volatile bool pulse_active;
+
+/* Single producer (sampler thread), single consumer (inference loop) ring.
+ * Each side only ever writes its own index, so no lock is needed; the
+ * semaphore is only there to let the consumer sleep.
+ */
+static struct ultrasonic_sample sample_queue[SAMPLE_QUEUE_LEN];
+static atomic_t queue_head;
+static atomic_t queue_tail;
+
+K_SEM_DEFINE(sample_ready_sem, 0, SAMPLE_QUEUE_LEN);
+K_SEM_DEFINE(sample_tick_sem, 0, 1);
+K_SEM_DEFINE(echo_sem, 0, 1);
+
+static void sample_timer_expiry(struct k_timer *timer) {
+    k_sem_give(&sample_tick_sem);
+}
+
+K_TIMER_DEFINE(sample_timer, sample_timer_expiry, NULL);
 
 static void pulse_callback(const struct device *dev, struct gpio_callback *callback, uint32_t pin) {
-    if (pulse_active) {
-        pulse_duration = k_cyc_to_us_floor32(k_cycle_get_32()) - pulse_start_time;
-        pulse_active = 0;
-    } else {
-        pulse_start_time = k_cyc_to_us_floor32(k_cycle_get_32());
-        //printf("Pulse started\n");
-        pulse_active = 1;
+    uint32_t now = k_cycle_get_32();
+
+    // Use the pin level rather than toggling state so a missed edge cannot
+    // leave start and end swapped for every following reading
+    if (gpio_pin_get(echo_port, ECHO_PIN)) {
+        pulse_start_cycles = now;
+        pulse_active = true;
+    } else if (pulse_active) {
+        pulse_duration = k_cyc_to_us_floor32(now - pulse_start_cycles);
+        pulse_active = false;
+        k_sem_give(&echo_sem);
+    }
+}
+
+static void sample_queue_push(const struct ultrasonic_sample *sample) {
+    atomic_val_t head = atomic_get(&queue_head);
+
+    if (head - atomic_get(&queue_tail) >= SAMPLE_QUEUE_LEN) {
+        // Consumer has fallen a full queue behind, drop the newest sample
+        return;
+    }
+    sample_queue[head & (SAMPLE_QUEUE_LEN - 1)] = *sample;
+    atomic_set(&queue_head, head + 1);
+    k_sem_give(&sample_ready_sem);
+}
+
+static void sampler_thread(void *p1, void *p2, void *p3) {
+    while (1) {
+        k_sem_take(&sample_tick_sem, K_FOREVER);
+
+        struct ultrasonic_sample sample = {
+            .timestamp = k_uptime_get_32(),
+        };
+
+        k_sem_reset(&echo_sem);
+        pulse_active = false;
+        //gpio_pin_set(trig_port, 5, 1);
+        gpio_pin_set(trig_port, TRIG_PIN, 1);
+        k_busy_wait(10);
+        //gpio_pin_set(trig_port, 5, 0);
+        gpio_pin_set(trig_port, TRIG_PIN, 0);
+
+        if (k_sem_take(&echo_sem, K_MSEC(ECHO_TIMEOUT_MS)) == 0) {
+            sample.duration = pulse_duration;
+            sample.valid = true;
+        }
+        sample_queue_push(&sample);
     }
 }
 
+K_THREAD_DEFINE(sampler_id, SAMPLER_STACK_SIZE, sampler_thread, NULL, NULL, NULL, SAMPLER_PRIORITY, 0, 0);
+
 void ultrasonic_init(void) {
     //gpio_pin_configure(trig_port, 5, GPIO_OUTPUT);
     //gpio_pin_configure(echo_port, 4, GPIO_INPUT);
     //gpio_pin_interrupt_configure(echo_port, 4, GPIO_INT_EDGE_BOTH);
     //gpio_init_callback(&pulse_info, pulse_callback, 1 << 4);
-    gpio_pin_configure(trig_port, 9, GPIO_OUTPUT);
-    gpio_pin_configure(echo_port, 8, GPIO_INPUT);
-    gpio_pin_interrupt_configure(echo_port, 8, GPIO_INT_EDGE_BOTH);
-    gpio_init_callback(&pulse_info, pulse_callback, 1 << 8);
+    gpio_pin_configure(trig_port, TRIG_PIN, GPIO_OUTPUT);
+    gpio_pin_configure(echo_port, ECHO_PIN, GPIO_INPUT);
+    gpio_pin_interrupt_configure(echo_port, ECHO_PIN, GPIO_INT_EDGE_BOTH);
+    gpio_init_callback(&pulse_info, pulse_callback, 1 << ECHO_PIN);
     gpio_add_callback(echo_port, &pulse_info);
-    gpio_pin_configure(mqtt_port, 5, GPIO_OUTPUT);
-    gpio_pin_configure(mqtt_port, 6, GPIO_OUTPUT);
+    gpio_pin_configure(mqtt_port, SIGNAL_LOWER_PIN, GPIO_OUTPUT);
+    gpio_pin_configure(mqtt_port, SIGNAL_HIGHER_PIN, GPIO_OUTPUT);
     gpio_pin_configure(mqtt_port, 7, GPIO_OUTPUT);
-    gpio_pin_set(mqtt_port, 5, 0);
-    gpio_pin_set(mqtt_port, 6, 0);
+    gpio_pin_set(mqtt_port, SIGNAL_LOWER_PIN, 0);
+    gpio_pin_set(mqtt_port, SIGNAL_HIGHER_PIN, 0);
     gpio_pin_set(mqtt_port, 7, 0);
+
+    k_timer_start(&sample_timer, K_MSEC(SAMPLE_PERIOD_MS), K_MSEC(SAMPLE_PERIOD_MS));
+}
+
+/**
+ * Block until the sampler thread has queued the next reading
+ */
+void ultrasonic_get_sample(struct ultrasonic_sample *sample) {
+    k_sem_take(&sample_ready_sem, K_FOREVER);
+
+    atomic_val_t tail = atomic_get(&queue_tail);
+    *sample = sample_queue[tail & (SAMPLE_QUEUE_LEN - 1)];
+    atomic_set(&queue_tail, tail + 1);
 }
 
 float ultrasonic_read(void) {
-    //gpio_pin_set(trig_port, 5, 1);
-    gpio_pin_set(trig_port, 9, 1);
-    k_busy_wait(10);
-    //gpio_pin_set(trig_port, 5, 0);
-    gpio_pin_set(trig_port, 9, 0);
-    k_msleep(50);
+    struct ultrasonic_sample sample;
+
+    ultrasonic_get_sample(&sample);
+    if (!sample.valid) {
+        // Nothing in range, report it the way the training data does
+        return ULTRASONIC_MAX_RANGE_M;
+    }
     // Speed of sound assumed
-    //printf("Duration=%d\n", pulse_duration);
-    return fmin(((pulse_duration / 1000000.0f) * 343.0f / 2.0f), 3.00);
+    //printf("Duration=%d\n", sample.duration);
+    return fmin(((sample.duration / 1000000.0f) * 343.0f / 2.0f), ULTRASONIC_MAX_RANGE_M);
 }
 
+struct gesture_signal {
+    uint32_t timestamp;     /* Uptime in ms when the gesture was decided */
+    int category;
+};
+
+K_MSGQ_DEFINE(signal_msgq, sizeof(struct gesture_signal), SIGNAL_QUEUE_LEN, 4);
+
+/**
+ * Drives the bridge pins from queued gestures so the inference loop never
+ * waits on signalling. Rate limiting compares gesture timestamps, a gesture
+ * within SIGNAL_HOLDOFF_MS of the last signalled one is dropped.
+ */
+static void signaller_thread(void *p1, void *p2, void *p3) {
+    struct gesture_signal signal;
+    uint32_t last_signal = 0;
+    bool signalled = false;
+
+    while (1) {
+        k_msgq_get(&signal_msgq, &signal, K_FOREVER);
+
+        if (signalled && signal.timestamp - last_signal < SIGNAL_HOLDOFF_MS) {
+            continue;
+        }
+        if (signal.category == 1) {
+            gpio_pin_toggle(mqtt_port, SIGNAL_LOWER_PIN);
+        } else {
+            gpio_pin_toggle(mqtt_port, SIGNAL_HIGHER_PIN);
+        }
+        last_signal = signal.timestamp;
+        signalled = true;
+    }
+}
+
+K_THREAD_DEFINE(signaller_id, SIGNALLER_STACK_SIZE, signaller_thread, NULL, NULL, NULL, SIGNALLER_PRIORITY, 0, 0);
+
+/**
+ * Hand a decided gesture to the signalling thread without blocking. Only
+ * the volume gestures (1 and 2) are signalled.
+ */
 void ultrasonic_publish(int category) {
-    //printf("Category %d\n", category);
-    
-    if (category == 1) {
-        gpio_pin_toggle(mqtt_port, 5);
-        //int pin_state = gpio_pin_get_raw(mqtt_port, 5);
-        //printf("Pin state before wait: %d\n", pin_state);
-        k_msleep(500);
-    } else if (category == 2) {
-        gpio_pin_toggle(mqtt_port, 6);
-        k_msleep(500);
-    } else if (category == 3) {
-        //gpio_pin_toggle(mqtt_port, 7);
-        //k_msleep(500);
+    if (category != 1 && category != 2) {
+        return;
     }
-    
-    //gpio_pin_toggle(mqtt_port, 5);
-    k_msleep(500);
+
+    struct gesture_signal signal = {
+        .timestamp = k_uptime_get_32(),
+        .category = category,
+    };
+    // A full queue means the signaller is already behind, and anything
+    // queued now would fall inside the holdoff anyway
+    k_msgq_put(&signal_msgq, &signal, K_NO_WAIT);
 }
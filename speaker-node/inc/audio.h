@@ -0,0 +1,53 @@
+#ifndef AUDIO_H_
+#define AUDIO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUDIO_SAMPLE_RATE_HZ  8000
+// Samples per half of the DAC double buffer, 32 ms at 8 kHz
+#define AUDIO_BLOCK_SAMPLES   256
+
+// DAC level of silence, samples swing either side of it
+#define AUDIO_DAC_MIDSCALE    128
+
+/* Anything that can be played. fill() writes up to n unsigned 8-bit DAC
+ * samples (AUDIO_DAC_MIDSCALE is silence) and returns how many it wrote; fewer than n
+ * means the source has finished. Embed it as the first member of the
+ * concrete source.
+ */
+struct audio_source {
+  size_t (*fill)(struct audio_source *src, uint8_t *out, size_t n);
+};
+
+struct audio_tone {
+  uint16_t freq;      /* Hz */
+  uint32_t samples;   /* Duration in samples at AUDIO_SAMPLE_RATE_HZ */
+};
+
+/* How a request interacts with what is already playing */
+enum audio_mode {
+  AUDIO_QUEUE,        /* Play after everything submitted before it */
+  AUDIO_PREEMPT,      /* Play now, cutting off whatever is playing. A cut
+                         off AUDIO_QUEUE sound plays again from its start
+                         afterwards, an AUDIO_PREEMPT one is dropped */
+  AUDIO_MIX,          /* Play now, mixed over whatever is playing */
+};
+
+/* What a request plays */
+enum audio_kind {
+  AUDIO_CHIME,        /* id is an enum chime_id */
+  AUDIO_CLIP,         /* id indexes the clips in flash */
+};
+
+struct audio_request {
+  uint8_t mode;       /* enum audio_mode */
+  uint8_t amplitude;  /* 255 is full scale */
+  uint8_t kind;       /* enum audio_kind */
+  uint16_t id;
+};
+
+int audio_init(void);
+int audio_submit(const struct audio_request *req);
+
+#endif // AUDIO_H_
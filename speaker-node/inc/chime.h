@@ -0,0 +1,35 @@
+#ifndef CHIME_H_
+#define CHIME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "audio.h"
+
+// Longest tone sequence in one chime
+#define CHIME_MAX_TONES       4
+// Longest single sine period a chime tone may have, in samples
+#define CHIME_MAX_PERIOD      256
+// Room for every distinct period, shared between the chimes
+#define CHIME_POOL_SIZE       512
+
+enum chime_id {
+  CHIME_ARRIVE,       /* 800 Hz then 400 Hz */
+  CHIME_DEPART,       /* 400 Hz then 800 Hz */
+  CHIME_VOLUME,       /* 800 Hz, confirms a volume change */
+  CHIME_COUNT,
+};
+
+/* Plays a cached chime, scaling the unit waveform as it goes */
+struct chime_source {
+  struct audio_source base;
+  uint8_t chime;
+  uint8_t segment;
+  uint16_t pos;       /* Index into the current period */
+  uint32_t remaining; /* Samples left in the current segment */
+  uint8_t amplitude;
+};
+
+int chime_cache_init(void);
+void chime_source_init(struct chime_source *src, uint8_t chime, uint8_t amplitude);
+
+#endif // CHIME_H_
@@ -0,0 +1,58 @@
+#ifndef CLIP_H_
+#define CLIP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "audio.h"
+
+#define CLIP_IMAGE_MAGIC      0x4C435053  /* "SPCL" */
+#define CLIP_IMAGE_VERSION    1
+// Bytes read from flash at a time while a clip plays
+#define CLIP_READ_CHUNK       64
+
+enum clip_format {
+  CLIP_FORMAT_PCM_U8,     /* One unsigned byte per sample */
+  CLIP_FORMAT_IMA_ADPCM,  /* 4 bits per sample, low nibble first */
+};
+
+/* Start of the clip partition, followed by count clip_entry records.
+ * Written by scripts/pack_clips.py, all fields little endian.
+ */
+struct clip_image_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t reserved[2];
+};
+
+struct clip_entry {
+  uint32_t offset;        /* Of the clip data from the start of the image */
+  uint32_t length;        /* Bytes of clip data */
+  uint32_t samples;
+  uint16_t rate;          /* Must match AUDIO_SAMPLE_RATE_HZ */
+  uint8_t format;         /* enum clip_format */
+  uint8_t reserved;
+};
+
+/* Streams one clip from flash, decoding a chunk at a time */
+struct clip_source {
+  struct audio_source base;
+  uint8_t format;
+  uint8_t amplitude;
+  uint32_t next;          /* Flash offset of the next chunk */
+  uint32_t bytes_left;    /* Not yet read from flash */
+  uint32_t samples_left;
+  int32_t predictor;      /* IMA-ADPCM decoder state */
+  int8_t step_index;
+  bool high_nibble;
+  uint8_t buf[CLIP_READ_CHUNK];
+  uint8_t buf_len;
+  uint8_t buf_pos;
+};
+
+int clip_store_init(void);
+size_t clip_count(void);
+void clip_source_init(struct clip_source *src, uint16_t id, uint8_t amplitude);
+
+#endif // CLIP_H_
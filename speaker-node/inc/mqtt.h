@@ -2,11 +2,29 @@
 #define MQTT_H_
 
 #include <stdint.h>
+#include <zephyr/kernel.h>
 
-struct mqtt_t {
-  uint8_t rx_buff[1024];
+#define MQTT_SUBSCRIBE_TOPIC "zephyrus/green/speaker"
+
+/* Largest "Volume <n>", the DAC amplitude is 8 bits */
+#define SPEAKER_VOLUME_MAX 255
+
+/* Commands published on MQTT_SUBSCRIBE_TOPIC by the dashboard */
+enum speaker_opcode {
+  SPEAKER_VOLUME,   /* "Volume <n>" */
+  SPEAKER_ARRIVE,   /* "Arrive" */
+  SPEAKER_DEPART,   /* "Depart" */
+  SPEAKER_CLIP,     /* "Clip <n>", a voice clip from flash */
 };
-extern struct k_msgq mqtt_msgq;
-extern struct mqtt_t;
 
-#endif // MQTT_H_
\ No newline at end of file
+/* Parsed in the MQTT thread, so only these few bytes are queued */
+struct speaker_cmd {
+  uint8_t opcode;
+  int16_t volume;   /* SPEAKER_VOLUME only */
+  uint16_t clip;    /* SPEAKER_CLIP only */
+};
+extern struct k_msgq speaker_msgq;
+
+void mqtt_init(void);
+
+#endif // MQTT_H_
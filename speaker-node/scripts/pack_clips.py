@@ -0,0 +1,137 @@
+"""
+Pack WAV files into the clip image read by clip.c. Clips are numbered in
+the order given, which is the <n> in the "Clip <n>" MQTT command.
+
+    python scripts/pack_clips.py ferry_arriving_uq.wav ferry_departing.wav clips.bin
+
+Any WAV is mixed down to mono and resampled to the speaker's 8 kHz. The
+image goes to the start of the board's storage partition, e.g.
+
+    esptool.py write_flash <storage_partition offset> clips.bin
+
+with the offset taken from the board devicetree.
+"""
+import argparse
+import struct
+import wave
+
+MAGIC = 0x4C435053  # "SPCL"
+IMAGE_VERSION = 1
+SAMPLE_RATE = 8000  # AUDIO_SAMPLE_RATE_HZ
+
+FORMAT_PCM_U8 = 0
+FORMAT_IMA_ADPCM = 1
+
+# struct clip_image_header and struct clip_entry
+HEADER_FORMAT = "<IHH8x"
+ENTRY_FORMAT = "<IIIHBx"
+
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+]
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+
+def read_wav(path):
+    """Return the file as 16-bit mono samples at SAMPLE_RATE."""
+    with wave.open(path, "rb") as w:
+        channels, width, rate = w.getnchannels(), w.getsampwidth(), w.getframerate()
+        frames = w.readframes(w.getnframes())
+
+    if width == 1:
+        raw = [(b - 128) << 8 for b in frames]
+    elif width == 2:
+        raw = [s for (s,) in struct.iter_unpack("<h", frames)]
+    else:
+        raise ValueError(f"{path}: only 8 and 16-bit WAV files are supported")
+    mono = [sum(raw[i:i + channels]) // channels for i in range(0, len(raw), channels)]
+
+    # Linear interpolation is plenty for speech going to an 8-bit DAC
+    count = len(mono) * SAMPLE_RATE // rate
+    samples = []
+    for i in range(count):
+        pos = i * rate / SAMPLE_RATE
+        j = int(pos)
+        nxt = mono[min(j + 1, len(mono) - 1)]
+        samples.append(int(mono[j] + (nxt - mono[j]) * (pos - j)))
+    return samples
+
+
+def ima_encode(samples):
+    """IMA-ADPCM from a zero predictor and step index, low nibble first.
+    The predictor is updated exactly as clip.c decodes, so errors never
+    accumulate between encoder and decoder."""
+    predictor, index = 0, 0
+    codes = []
+    for sample in samples:
+        step = STEP_TABLE[index]
+        diff = sample - predictor
+        code = 0
+        if diff < 0:
+            code, diff = 8, -diff
+        if diff >= step:
+            code |= 4
+            diff -= step
+        if diff >= step >> 1:
+            code |= 2
+            diff -= step >> 1
+        if diff >= step >> 2:
+            code |= 1
+
+        delta = step >> 3
+        if code & 4:
+            delta += step
+        if code & 2:
+            delta += step >> 1
+        if code & 1:
+            delta += step >> 2
+        predictor += -delta if code & 8 else delta
+        predictor = max(-32768, min(32767, predictor))
+        index = max(0, min(88, index + INDEX_TABLE[code & 7]))
+        codes.append(code)
+
+    if len(codes) % 2:
+        codes.append(0)
+    return bytes(codes[i] | (codes[i + 1] << 4) for i in range(0, len(codes), 2))
+
+
+def pcm_u8(samples):
+    return bytes((s >> 8) + 128 for s in samples)
+
+
+def pack(clips, fmt):
+    offset = struct.calcsize(HEADER_FORMAT) + len(clips) * struct.calcsize(ENTRY_FORMAT)
+    table, data = b"", b""
+    for samples in clips:
+        encoded = ima_encode(samples) if fmt == FORMAT_IMA_ADPCM else pcm_u8(samples)
+        table += struct.pack(ENTRY_FORMAT, offset + len(data), len(encoded), len(samples),
+                             SAMPLE_RATE, fmt)
+        data += encoded
+    return struct.pack(HEADER_FORMAT, MAGIC, IMAGE_VERSION, len(clips)) + table + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("clips", nargs="+", help="WAV files, clip 0 first")
+    parser.add_argument("output", help="image to write")
+    parser.add_argument("--pcm", action="store_true",
+                        help="store 8-bit PCM instead of IMA-ADPCM (twice the size)")
+    args = parser.parse_args()
+
+    clips = [read_wav(path) for path in args.clips]
+    image = pack(clips, FORMAT_PCM_U8 if args.pcm else FORMAT_IMA_ADPCM)
+    with open(args.output, "wb") as f:
+        f.write(image)
+    seconds = sum(len(c) for c in clips) / SAMPLE_RATE
+    print(f"Packed {len(clips)} clips, {seconds:.1f} s of audio, into {len(image)} byte image")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,361 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/dac.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include "../inc/audio.h"
+#include "../inc/chime.h"
+#include "../inc/clip.h"
+
+LOG_MODULE_REGISTER(audio, LOG_LEVEL_INF);
+
+#define AUDIO_DAC_CHANNEL   0       // GPIO25
+
+#define AUDIO_REQUEST_QUEUE_LEN 8
+// Requests waiting behind the current sound
+#define AUDIO_PENDING_LEN   8
+
+// Waits on requests and the DAC buffer together
+#define AUDIO_THREAD_STACK_SIZE 2048
+#define AUDIO_THREAD_PRIORITY 1
+
+/* The sample clock is a kernel timer, so the tick rate has to divide into
+ * whole sample periods or every tone comes out at the wrong pitch. prj.conf
+ * sets it to the sample rate. Build with -DAUDIO_PROFILE to log the cycles
+ * each sample takes in audio_tick(), on top of the kernel's timer interrupt.
+ */
+BUILD_ASSERT(CONFIG_SYS_CLOCK_TICKS_PER_SEC % AUDIO_SAMPLE_RATE_HZ == 0,
+             "CONFIG_SYS_CLOCK_TICKS_PER_SEC must be a multiple of AUDIO_SAMPLE_RATE_HZ");
+#define AUDIO_TICKS_PER_SAMPLE (CONFIG_SYS_CLOCK_TICKS_PER_SEC / AUDIO_SAMPLE_RATE_HZ)
+
+#ifndef CONFIG_POLL
+#error "The audio thread needs CONFIG_POLL, see prj.conf"
+#endif
+
+// Get DAC device from device tree
+static const struct device *dac_dev = DEVICE_DT_GET(DT_NODELABEL(dac));
+
+
+
+/* A request being played */
+struct voice {
+    bool active;
+    struct audio_request req;   // Kept to replay it if it is preempted
+    union {
+        struct audio_source base;
+        struct chime_source chime;
+        struct clip_source clip;
+    } src;
+};
+
+/* primary plays requests in order, overlay is mixed over it */
+static struct voice primary;
+static struct voice overlay;
+
+static struct audio_request pending[AUDIO_PENDING_LEN];
+static size_t pending_head;
+static size_t pending_count;
+
+/* Double buffer: audio_tick() plays blocks[play_block] while the audio
+ * thread refills the other half. A block is empty while its length is 0.
+ */
+static uint8_t blocks[2][AUDIO_BLOCK_SAMPLES];
+static atomic_t block_len[2];
+static volatile uint8_t play_block;
+static volatile bool source_done;
+
+// Timer for audio playback
+static struct k_timer audio_timer;
+static volatile uint32_t sample_index = 0;
+static volatile bool playing = false;
+
+#ifdef AUDIO_PROFILE
+// Over the last sound, logged when the next one starts
+static uint32_t tick_cycles;
+static uint32_t tick_count;
+#endif
+
+K_SEM_DEFINE(block_free_sem, 0, 2);
+K_MSGQ_DEFINE(audio_msgq, sizeof(struct audio_request), AUDIO_REQUEST_QUEUE_LEN, 2);
+
+/**
+ * One DAC write per expiry of the sample clock. If the next block is not ready
+ * yet the output holds its last level rather than glitching; once nothing
+ * more is coming the clock stops itself.
+ */
+static void play_sample(struct k_timer *timer) {
+    uint8_t block = play_block;
+    size_t len = atomic_get(&block_len[block]);
+
+    if (len == 0) {
+        if (source_done) {
+            k_timer_stop(timer);
+            playing = false;
+            dac_write_value(dac_dev, AUDIO_DAC_CHANNEL, AUDIO_DAC_MIDSCALE);
+        }
+        return;
+    }
+
+    dac_write_value(dac_dev, AUDIO_DAC_CHANNEL, blocks[block][sample_index]);
+    if (++sample_index == len) {
+        sample_index = 0;
+        atomic_set(&block_len[block], 0);
+        play_block = block ^ 1;
+        k_sem_give(&block_free_sem);
+    }
+}
+
+static void audio_tick(struct k_timer *timer) {
+#ifdef AUDIO_PROFILE
+    uint32_t start = k_cycle_get_32();
+    play_sample(timer);
+    tick_cycles += k_cycle_get_32() - start;
+    tick_count++;
+#else
+    play_sample(timer);
+#endif
+}
+
+/**
+* Initialise the DAC on GPIO 25 on the ESP32
+*/
+int audio_init(void) {
+    if (!device_is_ready(dac_dev)) {
+        LOG_ERR("DAC device not ready");
+        return -1;
+    }
+    
+    // Configure DAC channel 0 (GPIO25)
+    struct dac_channel_cfg dac_ch_cfg = {
+        .channel_id = AUDIO_DAC_CHANNEL,
+        .resolution = 8,        // 8-bit resolution
+        .buffered = false       // Direct output
+    };
+    
+    int ret = dac_channel_setup(dac_dev, &dac_ch_cfg);
+    if (ret < 0) {
+        LOG_ERR("Failed to setup DAC channel: %d", ret);
+        return ret;
+    }
+    dac_write_value(dac_dev, AUDIO_DAC_CHANNEL, AUDIO_DAC_MIDSCALE);
+
+    ret = chime_cache_init();
+    if (ret < 0) {
+        LOG_ERR("Failed to render chimes: %d", ret);
+        return ret;
+    }
+    if (clip_store_init() < 0) {
+        LOG_WRN("Clips unavailable, playing chimes only");
+    }
+    k_timer_init(&audio_timer, audio_tick, NULL);
+    
+    LOG_INF("DAC initialized successfully on GPIO25");
+    return 0;
+}
+
+static void voice_start(struct voice *voice, const struct audio_request *req) {
+    if (req->kind == AUDIO_CLIP) {
+        clip_source_init(&voice->src.clip, req->id, req->amplitude);
+    } else {
+        chime_source_init(&voice->src.chime, req->id, req->amplitude);
+    }
+    voice->req = *req;
+    voice->active = true;
+}
+
+static bool start_next_pending(void) {
+    if (pending_count == 0) {
+        return false;
+    }
+    voice_start(&primary, &pending[pending_head]);
+    pending_head = (pending_head + 1) % AUDIO_PENDING_LEN;
+    pending_count--;
+    return true;
+}
+
+/**
+ * Render the next n samples: the primary voice, moving straight on to the
+ * next queued request when one ends, with the overlay voice mixed on top.
+ */
+static size_t render(uint8_t *out, size_t n) {
+    size_t written = 0;
+
+    while (written < n) {
+        if (!primary.active && !start_next_pending()) {
+            break;
+        }
+        size_t got = primary.src.base.fill(&primary.src.base, out + written, n - written);
+        if (got < n - written) {
+            primary.active = false;
+        }
+        written += got;
+    }
+
+    if (overlay.active) {
+        uint8_t mix[AUDIO_BLOCK_SAMPLES];
+        size_t got = overlay.src.base.fill(&overlay.src.base, mix, n);
+        if (got < n) {
+            overlay.active = false;
+        }
+        for (size_t i = 0; i < got; i++) {
+            int32_t base = (i < written) ? out[i] : AUDIO_DAC_MIDSCALE;
+            out[i] = (uint8_t)CLAMP(base + mix[i] - AUDIO_DAC_MIDSCALE, 0, 255);
+        }
+        written = MAX(written, got);
+    }
+    return written;
+}
+
+static void fill_block(uint8_t block) {
+    size_t n = render(blocks[block], AUDIO_BLOCK_SAMPLES);
+
+    // Publish the block before flagging the end, so the last partial block
+    // is never mistaken for the end of playback
+    if (n > 0) {
+        atomic_set(&block_len[block], n);
+    }
+    if (n < AUDIO_BLOCK_SAMPLES) {
+        source_done = true;
+    }
+}
+
+/* Fill whichever halves are empty, the one due to play first */
+static void refill(void) {
+    uint8_t first = play_block;
+
+    if (atomic_get(&block_len[first]) == 0 && !source_done) {
+        fill_block(first);
+    }
+    if (atomic_get(&block_len[first ^ 1]) == 0 && !source_done) {
+        fill_block(first ^ 1);
+    }
+}
+
+/**
+ * New sound to play: keep the running clock from stopping, or restart it
+ * from a clean buffer if it already has.
+ */
+static void kick_output(void) {
+    unsigned int key = irq_lock();
+    source_done = false;
+    bool running = playing;
+    irq_unlock(key);
+
+    if (!running) {
+#ifdef AUDIO_PROFILE
+        if (tick_count > 0) {
+            LOG_INF("%u cycles per sample at %u cycles/s", tick_cycles / tick_count,
+                    sys_clock_hw_cycles_per_sec());
+            tick_cycles = 0;
+            tick_count = 0;
+        }
+#endif
+        play_block = 0;
+        sample_index = 0;
+        k_sem_reset(&block_free_sem);
+    }
+    refill();
+    if (!running && atomic_get(&block_len[play_block]) > 0) {
+        playing = true;
+        k_timer_start(&audio_timer, K_TICKS(AUDIO_TICKS_PER_SAMPLE), K_TICKS(AUDIO_TICKS_PER_SAMPLE));
+    }
+}
+
+/* Drop what is buffered so a preempting sound starts within a sample */
+static void flush_output(void) {
+    unsigned int key = irq_lock();
+    atomic_set(&block_len[0], 0);
+    atomic_set(&block_len[1], 0);
+    sample_index = 0;
+    irq_unlock(key);
+    k_sem_reset(&block_free_sem);
+}
+
+/**
+ * Put a sound cut off by a preempting one back at the front of the queue,
+ * to play again from its start.
+ */
+static void requeue_front(const struct audio_request *req) {
+    if (pending_count == AUDIO_PENDING_LEN) {
+        LOG_WRN("Audio queue full, dropping interrupted sound");
+        return;
+    }
+    pending_head = (pending_head + AUDIO_PENDING_LEN - 1) % AUDIO_PENDING_LEN;
+    pending[pending_head] = *req;
+    pending_count++;
+}
+
+static void handle_request(const struct audio_request *req) {
+    if (req->mode == AUDIO_PREEMPT) {
+        // A cut off announcement is played again rather than lost, an
+        // earlier preempting sound is simply replaced
+        if (primary.active && primary.req.mode != AUDIO_PREEMPT) {
+            requeue_front(&primary.req);
+        }
+        voice_start(&primary, req);
+        overlay.active = false;
+        flush_output();
+    } else if (req->mode == AUDIO_MIX && primary.active) {
+        voice_start(&overlay, req);
+    } else if (primary.active || pending_count > 0) {
+        if (pending_count == AUDIO_PENDING_LEN) {
+            LOG_WRN("Audio queue full, dropping request");
+            return;
+        }
+        pending[(pending_head + pending_count) % AUDIO_PENDING_LEN] = *req;
+        pending_count++;
+    } else {
+        voice_start(&primary, req);
+    }
+    kick_output();
+}
+
+/**
+ * Owns all playback state. Wakes for new requests and whenever the timer
+ * has emptied a block, so a long tone never holds up the next command.
+ */
+static void audio_thread(void *p1, void *p2, void *p3) {
+    struct k_poll_event events[] = {
+        K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_MSGQ_DATA_AVAILABLE,
+                                        K_POLL_MODE_NOTIFY_ONLY, &audio_msgq, 0),
+        K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_SEM_AVAILABLE,
+                                        K_POLL_MODE_NOTIFY_ONLY, &block_free_sem, 0),
+    };
+    struct audio_request req;
+
+    while (1) {
+        k_poll(events, ARRAY_SIZE(events), K_FOREVER);
+
+        if (events[0].state == K_POLL_STATE_MSGQ_DATA_AVAILABLE) {
+            while (k_msgq_get(&audio_msgq, &req, K_NO_WAIT) == 0) {
+                handle_request(&req);
+            }
+        }
+        if (events[1].state == K_POLL_STATE_SEM_AVAILABLE) {
+            k_sem_take(&block_free_sem, K_NO_WAIT);
+            refill();
+        }
+        events[0].state = K_POLL_STATE_NOT_READY;
+        events[1].state = K_POLL_STATE_NOT_READY;
+    }
+}
+
+K_THREAD_DEFINE(audio_id, AUDIO_THREAD_STACK_SIZE, audio_thread, NULL, NULL, NULL,
+                AUDIO_THREAD_PRIORITY, 0, 0);
+
+/**
+ * Hand a sound to the audio thread. Returns straight away; -ENOMEM if the
+ * request queue is full.
+ */
+int audio_submit(const struct audio_request *req) {
+    if ((req->kind == AUDIO_CHIME && req->id >= CHIME_COUNT) ||
+        (req->kind == AUDIO_CLIP && req->id >= clip_count())) {
+        return -EINVAL;
+    }
+    if (k_msgq_put(&audio_msgq, req, K_NO_WAIT) != 0) {
+        return -ENOMEM;
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <stdint.h>
+#include "../inc/audio.h"
+#include "../inc/chime.h"
+
+LOG_MODULE_REGISTER(chime, LOG_LEVEL_INF);
+
+// Each tone is 1.25 s at 8 kHz
+#define CHIME_TONE_SAMPLES  10000
+
+struct chime {
+    uint8_t count;
+    struct audio_tone tones[CHIME_MAX_TONES];
+};
+
+static const struct chime chimes[CHIME_COUNT] = {
+    [CHIME_ARRIVE] = { 2, { { 800, CHIME_TONE_SAMPLES }, { 400, CHIME_TONE_SAMPLES } } },
+    [CHIME_DEPART] = { 2, { { 400, CHIME_TONE_SAMPLES }, { 800, CHIME_TONE_SAMPLES } } },
+    [CHIME_VOLUME] = { 1, { { 800, CHIME_TONE_SAMPLES } } },
+};
+
+/* One sine period, indexed by the top 8 bits of a 32-bit phase */
+static const int8_t sine_table[256] = {
+       0,    3,    6,    9,   12,   16,   19,   22,   25,   28,   31,   34,   37,   40,   43,   46,
+      49,   51,   54,   57,   60,   63,   65,   68,   71,   73,   76,   78,   81,   83,   85,   88,
+      90,   92,   94,   96,   98,  100,  102,  104,  106,  107,  109,  111,  112,  113,  115,  116,
+     117,  118,  120,  121,  122,  122,  123,  124,  125,  125,  126,  126,  126,  127,  127,  127,
+     127,  127,  127,  127,  126,  126,  126,  125,  125,  124,  123,  122,  122,  121,  120,  118,
+     117,  116,  115,  113,  112,  111,  109,  107,  106,  104,  102,  100,   98,   96,   94,   92,
+      90,   88,   85,   83,   81,   78,   76,   73,   71,   68,   65,   63,   60,   57,   54,   51,
+      49,   46,   43,   40,   37,   34,   31,   28,   25,   22,   19,   16,   12,    9,    6,    3,
+       0,   -3,   -6,   -9,  -12,  -16,  -19,  -22,  -25,  -28,  -31,  -34,  -37,  -40,  -43,  -46,
+     -49,  -51,  -54,  -57,  -60,  -63,  -65,  -68,  -71,  -73,  -76,  -78,  -81,  -83,  -85,  -88,
+     -90,  -92,  -94,  -96,  -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+    -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+    -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+    -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100,  -98,  -96,  -94,  -92,
+     -90,  -88,  -85,  -83,  -81,  -78,  -76,  -73,  -71,  -68,  -65,  -63,  -60,  -57,  -54,  -51,
+     -49,  -46,  -43,  -40,  -37,  -34,  -31,  -28,  -25,  -22,  -19,  -16,  -12,   -9,   -6,   -3,
+};
+
+/* One exact period of a tone at full scale, stored in wave_pool */
+struct chime_wave {
+    uint16_t freq;
+    uint16_t period;
+    uint16_t offset;
+};
+
+static int8_t wave_pool[CHIME_POOL_SIZE];
+static struct chime_wave waves[CHIME_COUNT * CHIME_MAX_TONES];
+static size_t wave_count;
+static size_t pool_used;
+
+/* waves[] entry for each tone of each chime */
+static uint8_t segment_wave[CHIME_COUNT][CHIME_MAX_TONES];
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * Find or render the period of a frequency. A tone at f Hz repeats exactly
+ * every AUDIO_SAMPLE_RATE_HZ / gcd(rate, f) samples, 10 for 800 Hz, so that
+ * is all that needs storing however long the tone plays.
+ */
+static int wave_get(uint16_t freq) {
+    for (size_t i = 0; i < wave_count; i++) {
+        if (waves[i].freq == freq) {
+            return i;
+        }
+    }
+
+    uint32_t period = AUDIO_SAMPLE_RATE_HZ / gcd(AUDIO_SAMPLE_RATE_HZ, freq);
+    if (freq == 0 || period > CHIME_MAX_PERIOD) {
+        LOG_ERR("%u Hz does not repeat within %u samples", freq, CHIME_MAX_PERIOD);
+        return -EINVAL;
+    }
+    if (pool_used + period > CHIME_POOL_SIZE) {
+        return -ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < period; i++) {
+        // Phase of sample i in turns, exact since it is taken mod the rate
+        uint64_t turns = ((uint64_t)i * freq) % AUDIO_SAMPLE_RATE_HZ;
+        uint32_t phase = (uint32_t)((turns << 32) / AUDIO_SAMPLE_RATE_HZ);
+        wave_pool[pool_used + i] = sine_table[phase >> 24];
+    }
+
+    waves[wave_count] = (struct chime_wave){
+        .freq = freq, .period = period, .offset = pool_used,
+    };
+    pool_used += period;
+    return wave_count++;
+}
+
+/**
+ * Render every chime once at boot. The cache holds unit-amplitude waves, so
+ * a volume change never has to re-render anything.
+ */
+int chime_cache_init(void) {
+    for (size_t c = 0; c < CHIME_COUNT; c++) {
+        for (size_t t = 0; t < chimes[c].count; t++) {
+            int wave = wave_get(chimes[c].tones[t].freq);
+            if (wave < 0) {
+                return wave;
+            }
+            segment_wave[c][t] = wave;
+        }
+    }
+
+    LOG_INF("Cached %u chime waves in %u bytes", wave_count, pool_used);
+    return 0;
+}
+
+/**
+ * Loop each cached period for the length of its tone, scaled by a single
+ * multiply per sample.
+ */
+static size_t chime_fill(struct audio_source *base, uint8_t *out, size_t n) {
+    struct chime_source *src = (struct chime_source *)base;
+    const struct chime *chime = &chimes[src->chime];
+    size_t written = 0;
+
+    while (written < n && src->segment < chime->count) {
+        if (src->remaining == 0) {
+            if (++src->segment < chime->count) {
+                src->remaining = chime->tones[src->segment].samples;
+                src->pos = 0;
+            }
+            continue;
+        }
+
+        const struct chime_wave *wave = &waves[segment_wave[src->chime][src->segment]];
+        const int8_t *samples = &wave_pool[wave->offset];
+        uint32_t count = MIN(n - written, src->remaining);
+        for (uint32_t i = 0; i < count; i++) {
+            out[written++] = (uint8_t)(AUDIO_DAC_MIDSCALE + ((samples[src->pos] * src->amplitude) >> 8));
+            if (++src->pos == wave->period) {
+                src->pos = 0;
+            }
+        }
+        src->remaining -= count;
+    }
+    return written;
+}
+
+void chime_source_init(struct chime_source *src, uint8_t chime, uint8_t amplitude) {
+    src->base.fill = chime_fill;
+    src->chime = chime;
+    src->segment = 0;
+    src->pos = 0;
+    src->remaining = chimes[chime].count > 0 ? chimes[chime].tones[0].samples : 0;
+    src->amplitude = amplitude;
+}
@@ -0,0 +1,169 @@
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <errno.h>
+#include <stdint.h>
+#include "../inc/audio.h"
+#include "../inc/clip.h"
+
+LOG_MODULE_REGISTER(clip, LOG_LEVEL_INF);
+
+/* Clips live in the board's storage partition, 192 KiB on the ESP32
+ * DevKitC or about 48 s of ADPCM at 8 kHz.
+ */
+#define CLIP_PARTITION_ID   FIXED_PARTITION_ID(storage_partition)
+
+static const int16_t ima_step_table[89] = {
+        7,     8,     9,    10,    11,    12,    13,    14,    16,    17,
+       19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+       50,    55,    60,    66,    73,    80,    88,    97,   107,   118,
+      130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+      337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+      876,   963,  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+     2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+     5894,  6484,  7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t ima_index_table[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static const struct flash_area *clip_fa;
+static uint16_t clips;
+
+/**
+ * Check the clip image once at boot. A board without one still plays
+ * chimes, it just has no clips.
+ */
+int clip_store_init(void) {
+    struct clip_image_header header;
+
+    int ret = flash_area_open(CLIP_PARTITION_ID, &clip_fa);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = flash_area_read(clip_fa, 0, &header, sizeof(header));
+    if (ret < 0) {
+        return ret;
+    }
+    if (header.magic != CLIP_IMAGE_MAGIC || header.version != CLIP_IMAGE_VERSION) {
+        LOG_WRN("No clip image in flash");
+        return -ENOENT;
+    }
+    if (sizeof(header) + (size_t)header.count * sizeof(struct clip_entry) > clip_fa->fa_size) {
+        LOG_ERR("Clip table runs past the partition");
+        return -EINVAL;
+    }
+
+    clips = header.count;
+    LOG_INF("%u clips in flash", clips);
+    return 0;
+}
+
+size_t clip_count(void) {
+    return clips;
+}
+
+/**
+ * Read the next chunk of clip data into the source's buffer.
+ */
+static bool clip_read_chunk(struct clip_source *src) {
+    uint8_t len = MIN(src->bytes_left, sizeof(src->buf));
+
+    if (len == 0 || flash_area_read(clip_fa, src->next, src->buf, len) < 0) {
+        return false;
+    }
+    src->next += len;
+    src->bytes_left -= len;
+    src->buf_len = len;
+    src->buf_pos = 0;
+    return true;
+}
+
+/**
+ * Standard IMA-ADPCM step: a 4-bit code moves the predictor by a fraction
+ * of the current step size and adapts the step for the next sample.
+ */
+static int16_t ima_decode(struct clip_source *src, uint8_t code) {
+    int32_t step = ima_step_table[src->step_index];
+    int32_t diff = step >> 3;
+
+    if (code & 4) {
+        diff += step;
+    }
+    if (code & 2) {
+        diff += step >> 1;
+    }
+    if (code & 1) {
+        diff += step >> 2;
+    }
+    src->predictor += (code & 8) ? -diff : diff;
+    src->predictor = CLAMP(src->predictor, INT16_MIN, INT16_MAX);
+    src->step_index = CLAMP(src->step_index + ima_index_table[code & 7], 0, 88);
+    return src->predictor;
+}
+
+/**
+ * Decode straight into the DAC block. Only CLIP_READ_CHUNK bytes of the
+ * clip are ever in RAM, however long it is.
+ */
+static size_t clip_fill(struct audio_source *base, uint8_t *out, size_t n) {
+    struct clip_source *src = (struct clip_source *)base;
+    size_t written = 0;
+
+    while (written < n && src->samples_left > 0) {
+        if (src->buf_pos == src->buf_len && !clip_read_chunk(src)) {
+            src->samples_left = 0;
+            break;
+        }
+
+        int32_t value;
+        uint8_t byte = src->buf[src->buf_pos];
+        if (src->format == CLIP_FORMAT_IMA_ADPCM) {
+            uint8_t code = src->high_nibble ? byte >> 4 : byte & 0x0F;
+            // Scale 16-bit PCM by amplitude / 256 and down to 8 bits
+            value = (ima_decode(src, code) * src->amplitude) >> 16;
+            src->high_nibble = !src->high_nibble;
+            if (!src->high_nibble) {
+                src->buf_pos++;
+            }
+        } else {
+            value = ((byte - AUDIO_DAC_MIDSCALE) * src->amplitude) >> 8;
+            src->buf_pos++;
+        }
+        out[written++] = (uint8_t)(AUDIO_DAC_MIDSCALE + value);
+        src->samples_left--;
+    }
+    return written;
+}
+
+/**
+ * Start streaming clip id. A clip that cannot be played is logged and
+ * finishes straight away.
+ */
+void clip_source_init(struct clip_source *src, uint16_t id, uint8_t amplitude) {
+    struct clip_entry entry;
+
+    *src = (struct clip_source){
+        .base.fill = clip_fill,
+        .amplitude = amplitude,
+    };
+    if (id >= clips) {
+        return;
+    }
+
+    off_t offset = sizeof(struct clip_image_header) + id * sizeof(entry);
+    if (flash_area_read(clip_fa, offset, &entry, sizeof(entry)) < 0) {
+        LOG_ERR("Failed to read clip %u", id);
+        return;
+    }
+    if (entry.rate != AUDIO_SAMPLE_RATE_HZ || entry.format > CLIP_FORMAT_IMA_ADPCM ||
+        entry.offset + entry.length > clip_fa->fa_size) {
+        LOG_ERR("Clip %u is not playable", id);
+        return;
+    }
+
+    src->format = entry.format;
+    src->next = entry.offset;
+    src->bytes_left = entry.length;
+    src->samples_left = entry.samples;
+}